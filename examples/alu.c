@@ -0,0 +1,132 @@
+/* Copyright (c) 2019 Pedro Minicz */
+// the callbacks are linked directly so that only the instructions themselves
+// are measured
+#define M8080_EXTERN_CALLBACKS
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+#define M8080_PERF_IMPLEMENTATION
+#include "m8080_perf.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint8_t memory[0x10000];
+
+uint8_t m8080_rb(const m8080* const c, const uint16_t a) {
+  return memory[a];
+}
+
+void m8080_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  memory[a] = b;
+}
+
+void m8080_in(m8080* const c, const uint8_t a) { }
+void m8080_out(m8080* const c, const uint8_t a) { }
+
+void m8080_hlt(m8080* const c) { }
+
+// one instruction of every ALU class, all of them operate on the accumulator
+// and register C (or only on register C), daa is measured the way it is used,
+// after a BCD addition, so that it doesn't keep adjusting the same value
+static const struct {
+  const char* name;
+  uint8_t opcode[2];
+} classes[] = {
+  { "add", { 0x81, 0x81 } }, { "adc", { 0x89, 0x89 } },
+  { "sub", { 0x91, 0x91 } }, { "sbb", { 0x99, 0x99 } },
+  { "ana", { 0xa1, 0xa1 } }, { "xra", { 0xa9, 0xa9 } },
+  { "ora", { 0xb1, 0xb1 } }, { "cmp", { 0xb9, 0xb9 } },
+  { "inr", { 0x0c, 0x0c } }, { "dcr", { 0x0d, 0x0d } },
+  { "add+daa", { 0x81, 0x27 } },
+};
+
+// instructions of the measured class per loop iteration
+#define UNROLL 32
+
+static inline double seconds(const clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+  if(argc > 2) {
+    fprintf(stderr, "usage: %s [loops]\n", argv[0]);
+    return 1;
+  }
+  const size_t loops = argc > 1 ? strtoul(argv[1], NULL, 0) : 20000;
+
+  // host counters show whether a change to the dispatch really saved branch
+  // misses, they are only printed if the host lets us read them
+  m8080_perf perf;
+  const bool counters = m8080_perf_open(&perf);
+
+  printf("loops: %zu, 256 iterations of %d instructions per loop\n", loops, UNROLL);
+  for(size_t i = 0; i < sizeof(classes) / sizeof(*classes); ++i) {
+    // mvi b, 0; loop: op x UNROLL; dcr b; jnz loop; hlt
+    size_t pc = 0;
+    memory[pc++] = 0x06;
+    memory[pc++] = 0x00;
+    for(size_t j = 0; j < UNROLL; ++j) memory[pc++] = classes[i].opcode[j & 1];
+    memory[pc++] = 0x05;
+    memory[pc++] = 0xc2;
+    memory[pc++] = 0x02;
+    memory[pc++] = 0x00;
+    memory[pc++] = 0x76;
+
+    m8080 c = {0};
+    c.a = 0x19;
+    c.c = 0x37;
+    uint8_t check = 0;
+    size_t steps = 0;
+    m8080_perf_reset(&perf);
+    m8080_perf_begin(&perf, &c);
+    const clock_t start = clock();
+    for(size_t j = 0; j < loops; ++j) {
+      c.pc = 0x0000;
+      c.halted = 0;
+      while(!c.halted) {
+        m8080_step(&c);
+        ++steps;
+      }
+      check += c.a + c.c;
+    }
+    const double time = seconds(start);
+    m8080_perf_end(&perf, &c);
+
+    printf("%s: %.3fs, %.2f ns per instruction (check %02x)\n",
+        classes[i].name, time, time * 1e9 / steps, check);
+    if(counters) {
+      printf("  ");
+      m8080_perf_print(&perf, stdout);
+    }
+  }
+  if(!counters) printf("host performance counters unavailable\n");
+  m8080_perf_close(&perf);
+  return 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
@@ -0,0 +1,212 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// one thread runs thousands of machines, each talking to a terminal over a
+// socket as its serial line, a machine waiting for its terminal is suspended
+// in the middle of the in instruction instead of blocking the thread, and
+// `epoll` tells which ones can go on
+//
+// every machine echoes back each byte plus one, every terminal sends a line
+// and waits for the whole echo before sending the next one
+
+// in 0; inr a; out 1; jmp 0
+static const uint8_t program[] = { 0xdb, 0x00, 0x3c, 0xd3, 0x01, 0xc3, 0x00, 0x00 };
+
+#define LINE 16
+#define SLICE 10000
+
+typedef struct machine {
+  m8080 c;
+  int fd; // machine end of the serial line
+  int terminal; // the other end
+  size_t lines; // left to send
+  size_t received; // bytes of the current line
+  uint8_t line[LINE];
+} machine;
+
+static int poll_fd;
+static uint64_t suspensions;
+
+static uint8_t rb(const m8080* const c, const uint16_t a) {
+  return program[a % sizeof(program)];
+}
+
+static void wb(m8080* const c, const uint16_t a, const uint8_t b) { }
+
+// the machine is woken up when its end of the line is ready for EVENTS
+static void wait_for(machine* const m, const uint32_t events) {
+  struct epoll_event e = { .events = events | EPOLLONESHOT, .data.u64 = (uintptr_t)m };
+  epoll_ctl(poll_fd, EPOLL_CTL_MOD, m->fd, &e);
+  m8080_suspend(&m->c);
+  ++suspensions;
+}
+
+static void in(m8080* const c, const uint8_t a) {
+  machine* const m = c->userdata;
+  uint8_t b;
+  if(read(m->fd, &b, 1) == 1) c->a = b;
+  else if(errno == EAGAIN) wait_for(m, EPOLLIN);
+}
+
+static void out(m8080* const c, const uint8_t a) {
+  machine* const m = c->userdata;
+  if(write(m->fd, &c->a, 1) != 1 && errno == EAGAIN) wait_for(m, EPOLLOUT);
+}
+
+static const m8080_callbacks callbacks = { .rb = rb, .wb = wb, .in = in, .out = out };
+
+static void send_line(machine* const m, const size_t i) {
+  for(size_t j = 0; j < LINE; ++j) m->line[j] = i + m->lines * 7 + j;
+  m->received = 0;
+  if(write(m->terminal, m->line, LINE) != LINE) {
+    fprintf(stderr, "cannot write to terminal %zu\n", i);
+    exit(1);
+  }
+}
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+  if(argc > 3) {
+    fprintf(stderr, "usage: %s [machines] [lines]\n", argv[0]);
+    return 1;
+  }
+  const size_t count = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+  const size_t lines = argc > 2 ? strtoul(argv[2], NULL, 0) : 100;
+
+  machine* const machines = aligned_alloc(M8080_CACHE_LINE, count * sizeof(machine));
+  // machines that can run, each one is in here at most once
+  machine** const runnable = malloc(count * sizeof(machine*));
+  struct epoll_event* const events = malloc(count * sizeof(struct epoll_event));
+  poll_fd = epoll_create1(0);
+  if(!machines || !runnable || !events || poll_fd < 0) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  size_t running = 0;
+  for(size_t i = 0; i < count; ++i) {
+    machine* const m = &machines[i];
+    memset(m, 0, sizeof(*m));
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds)) {
+      fprintf(stderr, "cannot create %zu serial lines (raise ulimit -n)\n", count);
+      return 1;
+    }
+    m->fd = fds[0];
+    m->terminal = fds[1];
+    m->c.cb = &callbacks;
+    m->c.userdata = m;
+    // events of the terminal end have the lowest bit set
+    struct epoll_event e = { .events = 0, .data.u64 = (uintptr_t)m };
+    epoll_ctl(poll_fd, EPOLL_CTL_ADD, m->fd, &e);
+    e.events = EPOLLIN;
+    e.data.u64 = (uintptr_t)m | 1;
+    epoll_ctl(poll_fd, EPOLL_CTL_ADD, m->terminal, &e);
+    m->lines = lines;
+    if(lines) send_line(m, i);
+    runnable[running++] = m;
+  }
+
+  const double start = now();
+  size_t left = lines ? count : 0;
+  uint64_t slices = 0;
+  while(left) {
+    // every machine runs a slice, the ones that have to wait leave the list
+    for(size_t i = 0; i < running; ++slices) {
+      machine* const m = runnable[i];
+      m8080_run(&m->c, SLICE);
+      if(m->c.suspended) runnable[i] = runnable[--running];
+      else ++i;
+    }
+
+    const int n = epoll_wait(poll_fd, events, count, running ? 0 : -1);
+    for(int i = 0; i < n; ++i) {
+      machine* const m = (machine*)(uintptr_t)(events[i].data.u64 & ~(uint64_t)1);
+      if(events[i].data.u64 & 1) {
+        // the terminal reads the echo
+        uint8_t b[LINE];
+        const ssize_t size = read(m->terminal, b, LINE - m->received);
+        for(ssize_t j = 0; j < size; ++j, ++m->received) {
+          if(b[j] != (uint8_t)(m->line[m->received] + 1)) {
+            fprintf(stderr, "wrong echo from machine %zu\n", (size_t)(m - machines));
+            return 1;
+          }
+        }
+        if(m->received == LINE && --m->lines) send_line(m, m - machines);
+        else if(m->received == LINE) --left;
+        continue;
+      }
+      // the machine finishes the instruction it was suspended in
+      uint8_t b = 0;
+      if(m8080_rb(&m->c, m->c.pc) == 0xdb) {
+        if(read(m->fd, &b, 1) != 1) {
+          wait_for(m, EPOLLIN);
+          continue;
+        }
+      } else if(write(m->fd, &m->c.a, 1) != 1) {
+        wait_for(m, EPOLLOUT);
+        continue;
+      }
+      m8080_resume(&m->c, b);
+      runnable[running++] = m;
+    }
+  }
+  const double time = now() - start;
+
+  uint64_t cycles = 0;
+  for(size_t i = 0; i < count; ++i) {
+    cycles += machines[i].c.cycles;
+    close(machines[i].fd);
+    close(machines[i].terminal);
+  }
+  printf("%zu machines echoed %zu lines each in %.3fs on one thread\n", count, lines, time);
+  printf("%" PRIu64 " suspensions, %" PRIu64 " slices, %" PRIu64 " cycles (%.2f MHz)\n",
+      suspensions, slices, cycles, cycles / time / 1e6);
+  close(poll_fd);
+  free(events);
+  free(runnable);
+  free(machines);
+  return 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
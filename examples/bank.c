@@ -0,0 +1,221 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// a machine with 8 banks of 16 KiB switched into 0x4000..0x7fff by writing to
+// port 0, running a program that switches banks on every iteration, calls the
+// code in the bank and reads and writes data in it, four ways:
+//
+//  - `switch`: the address is decoded in `rb` and `wb` on every access
+//  - `paged`: the bank is mapped into `m8080_memory` when it is selected
+//  - `translated`: paged, with the fixed ROM translated ahead of time and the
+//    window fetched as usual
+//  - `window`: paged, with the window translated too and invalidated whenever
+//    another bank is selected, which costs more than it saves when banks are
+//    switched this often
+//
+// the fixed ROM is at 0x0000..0x3fff and RAM at 0x8000..0xffff
+
+static const uint8_t program[] = {
+  0x31, 0x00, 0x00, // lxi sp, 0x0000
+  0x0e, 0x00,       // mvi c, 0
+  0x06, 0x00,       // mvi b, 0
+  0x79,             // loop: mov a, c
+  0xe6, 0x07,       // ani 7
+  0xd3, 0x00,       // out 0 ; select bank
+  0xcd, 0x00, 0x40, // call 0x4000 ; code in the bank
+  0x80,             // add b
+  0x21, 0x23, 0x41, // lxi h, 0x4123
+  0x86,             // add m ; data in the bank
+  0x34,             // inr m
+  0x32, 0x00, 0x80, // sta 0x8000
+  0x47,             // mov b, a
+  0x0c,             // inr c
+  0xc3, 0x07, 0x00, // jmp loop
+};
+
+#define BANKS 8
+#define WINDOW 0x4000
+#define SLICE 100000
+
+static uint8_t rom[0x4000];
+static uint8_t banks[BANKS][WINDOW];
+static uint8_t ram[0x8000];
+static uint8_t bank;
+
+static void reset(m8080* const c) {
+  memset(c, 0, sizeof(*c));
+  memset(rom, 0, sizeof(rom));
+  memcpy(rom, program, sizeof(program));
+  memset(ram, 0, sizeof(ram));
+  for(size_t i = 0; i < BANKS; ++i) {
+    memset(banks[i], 0, WINDOW);
+    banks[i][0] = 0x3e; // mvi a, N
+    banks[i][1] = i * 5 + 1;
+    banks[i][2] = 0xc9; // ret
+  }
+  bank = 0;
+}
+
+static uint8_t switch_rb(const m8080* const c, const uint16_t a) {
+  switch(a >> 14) {
+  case 0: return rom[a];
+  case 1: return banks[bank][a & 0x3fff];
+  default: return ram[a & 0x7fff];
+  }
+}
+
+static void switch_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  switch(a >> 14) {
+  case 0: break;
+  case 1: banks[bank][a & 0x3fff] = b; break;
+  default: ram[a & 0x7fff] = b; break;
+  }
+}
+
+static void switch_out(m8080* const c, const uint8_t a) {
+  bank = c->a & (BANKS - 1);
+}
+
+static const m8080_callbacks switch_callbacks = {
+  .rb = switch_rb, .wb = switch_wb, .out = switch_out,
+};
+
+static m8080_rom translation;
+static m8080_rom* translated;
+
+static void paged_out(m8080* const c, const uint8_t a) {
+  bank = c->a & (BANKS - 1);
+  m8080_memory_map(c->userdata, 0x4000, WINDOW, banks[bank], false);
+  if(translated) m8080_rom_invalidate(translated, 0x4000, WINDOW);
+}
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// final state of a run, to compare them
+typedef struct result {
+  m8080 c;
+  uint64_t hash;
+} result;
+
+static result finish(const char* const name, const m8080* const c, const double time) {
+  printf("%-10s %" PRIu64 " cycles in %.3fs (%.2f MHz)\n",
+      name, c->cycles, time, c->cycles / time / 1e6);
+  result r = { .c = *c, .hash = 0xcbf29ce484222325 };
+  const uint8_t* const parts[] = { ram, &banks[0][0] };
+  const size_t sizes[] = { sizeof(ram), sizeof(banks) };
+  for(size_t i = 0; i < 2; ++i) {
+    for(size_t j = 0; j < sizes[i]; ++j) r.hash = (r.hash ^ parts[i][j]) * 0x100000001b3;
+  }
+  return r;
+}
+
+static result run_switch(const uint64_t cycles) {
+  m8080 c;
+  reset(&c);
+  c.cb = &switch_callbacks;
+  const double time = now();
+  while(c.cycles < cycles) m8080_run(&c, SLICE);
+  return finish("switch", &c, now() - time);
+}
+
+// `translate` bytes from 0x0000 are translated
+static result run_paged(const char* const name, const uint64_t cycles, const size_t translate) {
+  m8080 c;
+  reset(&c);
+  m8080_memory m;
+  if(!m8080_memory_init(&m)) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  m8080_memory_load(&m, 0x0000, rom, sizeof(rom));
+  m8080_memory_protect(&m, 0x0000, sizeof(rom));
+  m8080_memory_map(&m, 0x4000, WINDOW, banks[0], false);
+  m8080_callbacks callbacks = m8080_memory_callbacks;
+  callbacks.out = paged_out;
+  c.cb = &callbacks;
+  c.userdata = &m;
+
+  translated = NULL;
+  if(translate) {
+    if(!m8080_rom_init(&translation, &c, 0x0000, translate)) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+    m8080_rom_translate(&translation, &c, 0x0000);
+    translated = &translation;
+  }
+
+  const double time = now();
+  if(translate) {
+    while(c.cycles < cycles) m8080_rom_run(&c, translated, SLICE);
+  } else {
+    while(c.cycles < cycles) m8080_run(&c, SLICE);
+  }
+  // the RAM is copied out to be compared like the other runs
+  for(size_t i = 0; i < sizeof(ram); ++i) ram[i] = m8080_memory_rb(&m, 0x8000 + i);
+  const result r = finish(name, &c, now() - time);
+  if(translate) m8080_rom_free(&translation);
+  m8080_memory_free(&m);
+  return r;
+}
+
+static bool same(const result* const x, const result* const y) {
+  return x->hash == y->hash && x->c.cycles == y->c.cycles && x->c.pc == y->c.pc
+    && x->c.sp == y->c.sp && x->c.psw == y->c.psw && x->c.bc == y->c.bc
+    && x->c.de == y->c.de && x->c.hl == y->c.hl;
+}
+
+int main(int argc, char** argv) {
+  if(argc > 2) {
+    fprintf(stderr, "usage: %s [cycles]\n", argv[0]);
+    return 1;
+  }
+  const uint64_t cycles = argc > 1 ? strtoull(argv[1], NULL, 0) : 200000000;
+
+  const result expected = run_switch(cycles);
+  const result paged = run_paged("paged", cycles, 0);
+  const result translated = run_paged("translated", cycles, 0x4000);
+  const result window = run_paged("window", cycles, 0x8000);
+  if(!same(&paged, &expected) || !same(&translated, &expected) || !same(&window, &expected)) {
+    printf("the runs ended in different states\n");
+    return 1;
+  }
+  return 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
@@ -0,0 +1,186 @@
+/* Copyright (c) 2019 Pedro Minicz */
+// the callbacks are linked directly so that they can be inlined into both
+// `m8080_step` and `m8080_batch_step`
+#define M8080_EXTERN_CALLBACKS
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+#define M8080_BATCH_IMPLEMENTATION
+#include "m8080_batch.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// the memories of the lanes are a few cache lines apart from a multiple of
+// 64 KiB, or the same address of every lane would compete for the same set of
+// the L1 cache
+#define MEMORY (0x10000 + 0x1c0)
+
+uint8_t m8080_rb(const m8080* const c, const uint16_t a) {
+  const uint8_t* const memory = c->userdata;
+  return memory[a];
+}
+
+void m8080_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  uint8_t* const memory = c->userdata;
+  memory[a] = b;
+}
+
+void m8080_in(m8080* const c, const uint8_t a) { }
+void m8080_out(m8080* const c, const uint8_t a) { }
+
+void m8080_hlt(m8080* const c) { }
+
+static inline double seconds(const clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// every lane gets its own copy of the ROM, optionally advanced by `skew`
+// instructions per lane so that they start out of step
+static inline void load(m8080* const c, uint8_t* const memory,
+    const uint8_t* const rom, const size_t len, const size_t skew) {
+  memset(c, 0, sizeof(*c));
+  memset(memory, 0, 0x10000);
+  memcpy(memory + 0x0100, rom, len);
+  memory[0x0005] = 0xc9; // RET, printing is ignored here
+  c->userdata = memory;
+  c->pc = 0x0100;
+  for(size_t i = 0; i < skew; ++i) m8080_step(c);
+}
+
+// runs the machines in lockstep until every lane reached `cycles`, with the
+// first `shared` bytes of the program decoded once for every lane, returns the
+// time it took and stores the average number of lanes per step in `width`
+static double run_batch(m8080_batch* const b, uint8_t* const memory, const size_t lanes,
+    const uint8_t* const rom, const size_t len, const size_t cycles, const size_t skew,
+    const size_t shared, double* const width) {
+  memset(b, 0, sizeof(*b));
+  b->lanes = lanes;
+  b->shared = 0x0100;
+  b->shared_size = shared;
+  for(size_t i = 0; i < lanes; ++i) {
+    m8080 tmp;
+    load(&tmp, memory + i * MEMORY, rom, len, i * skew);
+    m8080_batch_set(b, i, &tmp);
+  }
+  size_t steps = 0, executed = 0;
+  const clock_t start = clock();
+  for(;;) {
+    size_t done = 0;
+    for(size_t i = 0; i < lanes; ++i) done += b->cycles[i] >= cycles;
+    if(done == lanes) break;
+    for(size_t i = 0; i < 256; ++i) {
+      executed += m8080_batch_step(b);
+      ++steps;
+    }
+  }
+  *width = (double)executed / steps;
+  return seconds(start);
+}
+
+// the batch may have run some lanes further than `cycles`, catches the
+// independent machines up and returns the number of lanes that don't agree
+static size_t compare(const m8080_batch* const b, m8080* const c, const uint8_t* const memory,
+    const uint8_t* const batch_memory, const size_t lanes) {
+  size_t mismatches = 0;
+  for(size_t i = 0; i < lanes; ++i) {
+    // start from a copy so that padding bytes compare equal
+    m8080 lane = c[i];
+    m8080_batch_get(b, i, &lane);
+    while(c[i].cycles < lane.cycles) m8080_step(&c[i]);
+    lane.userdata = c[i].userdata;
+    if(memcmp(&lane, &c[i], sizeof(lane))
+        || memcmp(memory + i * MEMORY, batch_memory + i * MEMORY, 0x10000)) {
+      printf("lane %zu differs\n", i);
+      ++mismatches;
+    }
+  }
+  return mismatches;
+}
+
+int main(int argc, char** argv) {
+  if(argc < 2 || argc > 6) {
+    fprintf(stderr, "usage: %s file [lanes] [cycles] [skew] [shared]\n", argv[0]);
+    return 1;
+  }
+  const size_t lanes = argc > 2 ? strtoul(argv[2], NULL, 0) : M8080_BATCH_LANES;
+  const size_t cycles = argc > 3 ? strtoul(argv[3], NULL, 0) : 20000000;
+  const size_t skew = argc > 4 ? strtoul(argv[4], NULL, 0) : 0;
+  if(lanes == 0 || lanes > M8080_BATCH_LANES) {
+    fprintf(stderr, "lanes must be between 1 and %d\n", M8080_BATCH_LANES);
+    return 1;
+  }
+
+  static uint8_t rom[0x10000 - 0x0100];
+  FILE* f = fopen(argv[1], "rb");
+  if(!f) {
+    fprintf(stderr, "cannot open file: %s\n", argv[1]);
+    return 1;
+  }
+  const size_t len = fread(rom, 1, sizeof(rom), f);
+  fclose(f);
+  // the program is code that is never written unless told otherwise, 8080EXER
+  // writes the instruction under test at 0x0d4d so only 0x0c4d bytes are
+  const size_t shared = argc > 5 ? strtoul(argv[5], NULL, 0) : len;
+
+  uint8_t* const memory = malloc((size_t)2 * lanes * MEMORY);
+  m8080* const c = aligned_alloc(M8080_CACHE_LINE, lanes * sizeof(m8080));
+  static m8080_batch b;
+  if(!memory || !c) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  // independent machines, one after the other
+  for(size_t i = 0; i < lanes; ++i) load(&c[i], memory + i * MEMORY, rom, len, i * skew);
+  const clock_t start = clock();
+  for(size_t i = 0; i < lanes; ++i) {
+    while(c[i].cycles < cycles) m8080_step(&c[i]);
+  }
+  const double step_time = seconds(start);
+  printf("lanes: %zu, cycles per lane: %zu, skew: %zu, shared: 0x%zx\n", lanes, cycles, skew, shared);
+  printf("m8080_step: %.3fs\n", step_time);
+
+  // the same machines in lockstep, decoding every instruction in every lane
+  // and then decoding the program once for all of them
+  uint8_t* const batch_memory = memory + lanes * MEMORY;
+  size_t mismatches = 0;
+  for(int i = 0; i < 2; ++i) {
+    double width;
+    const double time = run_batch(&b, batch_memory, lanes, rom, len, cycles, skew,
+        i ? shared : 0, &width);
+    printf("m8080_batch_step%s: %.3fs, %.2f lanes per step\n",
+        i ? " (shared code)" : "", time, width);
+    mismatches += compare(&b, c, memory, batch_memory, lanes);
+  }
+
+  free(memory);
+  free(c);
+  return mismatches != 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
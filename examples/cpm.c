@@ -0,0 +1,75 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+#define M8080_CPM_IMPLEMENTATION
+#include "m8080_cpm.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+static inline double seconds(const clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+  if(argc < 2) {
+    fprintf(stderr, "usage: %s file [arguments...]\n", argv[0]);
+    return 1;
+  }
+
+  static m8080_cpm cpm;
+  m8080 c;
+  m8080_cpm_init(&cpm, &c);
+  if(!m8080_cpm_load(&cpm, argv[1])) {
+    fprintf(stderr, "cannot open file: %s\n", argv[1]);
+    return 1;
+  }
+
+  // the rest of the arguments are the command tail
+  char tail[128] = "";
+  for(int i = 2; i < argc; ++i) {
+    if(i > 2) strncat(tail, " ", sizeof(tail) - strlen(tail) - 1);
+    strncat(tail, argv[i], sizeof(tail) - strlen(tail) - 1);
+  }
+  m8080_cpm_args(&cpm, tail);
+  cpm.line = isatty(fileno(stdout));
+
+  // stepping rather than `m8080_run` so that the cycle count stops exactly
+  // where the program did
+  const clock_t start = clock();
+  while(!cpm.done) m8080_step(&c);
+  const double time = seconds(start);
+  m8080_cpm_free(&cpm);
+
+  fprintf(stderr, "%" PRIu64 " cycles in %.3fs (%.2f MHz)\n",
+      c.cycles, time, c.cycles / time / 1e6);
+  return 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
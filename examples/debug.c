@@ -1,7 +1,10 @@
 /* Copyright (c) 2019 Pedro Minicz */
 #define M8080_IMPLEMENTATION
 #include "m8080.h"
+#define M8080_CPM_IMPLEMENTATION
+#include "m8080_cpm.h"
 
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -24,23 +27,6 @@ typedef struct Command {
   int data;
 } Command;
 
-uint8_t m8080_rb(const m8080* const c, const uint16_t a) {
-  const uint8_t* const memory = c->userdata;
-  return memory[a];
-}
-
-void m8080_wb(m8080* const c, const uint16_t a, const uint8_t b) {
-  uint8_t* const memory = c->userdata;
-  memory[a] = b;
-}
-
-void m8080_in(m8080* const c, const uint8_t a) { }
-void m8080_out(m8080* const c, const uint8_t a) { }
-
-void m8080_hlt(m8080* const c) {
-  --c->pc;
-}
-
 static inline int read_argument(void) {
   int ret = -1;
   // read until optional argument or end of line
@@ -133,45 +119,21 @@ static inline int debug_disassemble(const m8080* const c, const uint16_t pos, co
   case 0xec: // cpe
   case 0xe4: // cpo
     if(m8080_rw(c, pos + 1) == 0x0005) {
-      printf("\t; special print function");
+      printf("\t; BDOS function %d", c->c);
     }
   }
   putchar('\n');
   return ret;
 }
 
-static inline size_t debug_step(m8080* const c) {
-  const size_t ret = m8080_step(c);
-
-  // handle `call 0005`
-  if(c->pc == 0x0005) {
-    // prints memory from DE until '$' is found
-    if(c->c == 0x09) {
-      for(uint16_t i = c->de; m8080_rb(c, i) != '$'; ++i) {
-        putchar(m8080_rb(c, i));
-      }
-    }
-    if(c->c == 0x02) putchar(c->e);
-
-    c->pc = m8080_rw(c, c->sp);
-    c->sp += 2;
-  }
-
-  return ret;
-}
-
 static inline void print_registers(const m8080* const c) {
-  uint8_t f = 0x02; // bit 1 is always 1, refer to `m8080_push_psw` for more info
-  f |= c->f.c << 0;
-  f |= c->f.p << 2;
-  f |= c->f.a << 4;
-  f |= c->f.z << 6;
-  f |= c->f.s << 7;
   printf("    af   bc   de   hl   pc   sp  flags cycles\n");
-  printf("0x %02x%02x %04x %04x %04x %04x %04x %c%c%c%c%c %zu\n",
-      c->a, f, c->bc, c->de, c->hl, c->pc, c->sp,
-      c->f.c ? 'c' : '.', c->f.p ? 'p' : '.', c->f.a ? 'a' : '.',
-      c->f.z ? 'z' : '.', c->f.s ? 's' : '.', c->cycles);
+  // bit 1 is always 1, refer to `m8080_push_psw` for more info
+  printf("0x %04x %04x %04x %04x %04x %04x %c%c%c%c%c %" PRIu64 "\n",
+      c->psw | 0x02, c->bc, c->de, c->hl, c->pc, c->sp,
+      M8080_GET_FLAG(c, C) ? 'c' : '.', M8080_GET_FLAG(c, P) ? 'p' : '.',
+      M8080_GET_FLAG(c, A) ? 'a' : '.', M8080_GET_FLAG(c, Z) ? 'z' : '.',
+      M8080_GET_FLAG(c, S) ? 's' : '.', c->cycles);
 }
 
 int main(int argc, char** argv) {
@@ -180,21 +142,14 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  m8080 c = {0};
-  uint8_t memory[0x10000] = {0};
-  c.userdata = memory;
-  c.pc = 0x0100; // the test ROMs expect to be loaded at 0x0100
-
-  FILE* f = fopen(argv[1], "rb");
-  if(!f) {
+  // the program runs under CP/M, when it is finished the CPU halts
+  static m8080_cpm cpm;
+  m8080 c;
+  m8080_cpm_init(&cpm, &c);
+  if(!m8080_cpm_load(&cpm, argv[1])) {
     fprintf(stderr, "cannot open file: %s\n", argv[1]);
     return 1;
   }
-  fread(memory + c.pc, 1, sizeof(memory) - c.pc, f);
-  fclose(f);
-
-  // the test ROMs jump to 0x0000 when finished
-  memory[0x0000] = 0x76; // hlt
 
   bool breakpoint[0x10000] = {0};
 
@@ -214,17 +169,19 @@ int main(int argc, char** argv) {
             cmd.data);
         break;
       case CONTINUE:
-        debug_step(&c);
+        m8080_step(&c);
         for(;;) {
           if(m8080_rb(&c, c.pc) == 0x76) {
+            m8080_cpm_flush(&cpm);
             printf("hit halt instruction at 0x%04x\n", c.pc);
             break;
           }
           if(breakpoint[c.pc]) {
+            m8080_cpm_flush(&cpm);
             printf("hit breakpoint at 0x%04x\n", c.pc);
             break;
           }
-          debug_step(&c);
+          m8080_step(&c);
         }
         break;
       case DISASSEMBLE: {
@@ -264,8 +221,9 @@ int main(int argc, char** argv) {
         return 0;
       case STEP:
         for(size_t i = 0; i < cmd.data; ++i) {
-          debug_step(&c);
+          m8080_step(&c);
         }
+        m8080_cpm_flush(&cpm);
         break;
       case HELP:
       default:
@@ -7,47 +7,26 @@
 #include <stdint.h>
 #include <stdio.h>
 
-static const size_t length[] = {
-  1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 00..0f
-  1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 00..1f
-  1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, // 20..2f
-  1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, // 30..3f
-  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 40..4f
-  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 50..5f
-  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 60..6f
-  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 70..7f
-  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 80..8f
-  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 90..9f
-  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // a0..af
-  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // b0..bf
-  1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 3, 3, 3, 2, 1, // c0..cf
-  1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, // d0..df
-  1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1, // e0..ef
-  1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1, // f0..ff
-};
-
-uint8_t m8080_rb(const m8080* const c, const uint16_t a) {
+static uint8_t memory_rb(const m8080* const c, const uint16_t a) {
   const uint8_t* const memory = c->userdata;
   return memory[a];
 }
 
-void m8080_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+static void memory_wb(m8080* const c, const uint16_t a, const uint8_t b) {
   uint8_t* const memory = c->userdata;
   memory[a] = b;
 }
 
-void m8080_in(m8080* const c, const uint8_t a) { }
-void m8080_out(m8080* const c, const uint8_t a) { }
-
-void m8080_hlt(m8080* const c) {
-  --c->pc;
-}
+static const m8080_callbacks callbacks = {
+  .rb = memory_rb,
+  .wb = memory_wb,
+};
 
 void map(const m8080* const c, size_t pos, uint8_t* const memory_map) {
   while(pos < 0x10000) {
     if(memory_map[pos] >= 3) break;
 
-    const size_t l = length[m8080_rb(c, pos)];
+    const size_t l = m8080_size[m8080_rb(c, pos)];
 
     if(l >= 3) memory_map[pos + 2] += 1;
     if(l >= 2) memory_map[pos + 1] += 1;
@@ -104,6 +83,7 @@ int main(int argc, char** argv) {
   m8080 c = {0};
   uint8_t memory[0x10000] = {0};
   c.userdata = memory;
+  c.cb = &callbacks;
   c.pc = 0x0100; // the test ROMs expect to be loaded at 0x0100
 
   FILE* f = fopen(argv[1], "rb");
@@ -0,0 +1,146 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// forks a machine running a test ROM many times and compares the cost of a
+// copy-on-write fork with copying the whole 64 KiB, then runs every child for
+// a few steps and checks that what they wrote stays out of the parent, the
+// ROM must write memory (8080EXER does, TST8080 is done long before):
+//
+//      $ ./fork roms/8080EXER.COM
+
+static inline double seconds(const clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void flatten(uint8_t* const flat, const m8080_memory* const m) {
+  for(size_t i = 0; i < M8080_PAGES; ++i) {
+    memcpy(flat + i * M8080_PAGE_SIZE, m->read[i], M8080_PAGE_SIZE);
+  }
+}
+
+int main(int argc, char** argv) {
+  if(argc < 2 || argc > 4) {
+    fprintf(stderr, "usage: %s file [children] [steps]\n", argv[0]);
+    return 1;
+  }
+  const size_t children = argc > 2 ? strtoul(argv[2], NULL, 0) : 4096;
+  const size_t steps = argc > 3 ? strtoul(argv[3], NULL, 0) : 1000;
+
+  m8080_memory memory;
+  if(!m8080_memory_init(&memory)) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  static uint8_t rom[0x10000 - 0x0100];
+  FILE* f = fopen(argv[1], "rb");
+  if(!f) {
+    fprintf(stderr, "cannot open file: %s\n", argv[1]);
+    return 1;
+  }
+  const size_t len = fread(rom, 1, sizeof(rom), f);
+  fclose(f);
+
+  // the test ROMs expect to be loaded at 0x0100 and to find a print function
+  // at 0x0005, printing is ignored here
+  const uint8_t ret = 0xc9;
+  m8080_memory_load(&memory, 0x0100, rom, len);
+  m8080_memory_load(&memory, 0x0005, &ret, 1);
+
+  m8080 parent = {0};
+  parent.userdata = &memory;
+  parent.cb = &m8080_memory_callbacks;
+  parent.pc = 0x0100;
+  // get somewhere interesting before branching
+  for(size_t i = 0; i < 100000; ++i) m8080_step(&parent);
+
+  // only what a child costs before it runs: sharing every page and dropping
+  // them again, against copying them
+  clock_t start = clock();
+  for(size_t i = 0; i < children; ++i) {
+    m8080_memory child_memory;
+    m8080_memory_fork(&child_memory, &memory);
+    m8080_memory_free(&child_memory);
+  }
+  const double fork_time = seconds(start);
+
+  static uint8_t flat[0x10000];
+  start = clock();
+  for(size_t i = 0; i < children; ++i) flatten(flat, &memory);
+  const double copy_time = seconds(start);
+
+  // every child runs on its own copy of the pages it writes, the parent must
+  // look exactly as it did before
+  static uint8_t before[0x10000];
+  static uint8_t after[0x10000];
+  flatten(before, &memory);
+  size_t copied = 0;
+  size_t changed = 0;
+  bool isolated = true;
+  for(size_t i = 0; i < children; ++i) {
+    m8080_memory child_memory;
+    m8080_memory_fork(&child_memory, &memory);
+    m8080 child = parent;
+    child.userdata = &child_memory;
+    for(size_t j = 0; j < steps; ++j) m8080_step(&child);
+
+    for(size_t j = 0; j < M8080_PAGES; ++j) {
+      copied += child_memory.page[j] != memory.page[j];
+    }
+    flatten(after, &child_memory);
+    for(size_t j = 0; j < 0x10000; ++j) changed += after[j] != before[j];
+    m8080_memory_free(&child_memory);
+
+    flatten(after, &memory);
+    isolated &= !memcmp(after, before, 0x10000);
+  }
+
+  printf("children: %zu, steps per child: %zu\n", children, steps);
+  printf("fork and free: %.3fs, full copy: %.3fs (%d bytes per child)\n",
+      fork_time, copy_time, 0x10000);
+  printf("%.2f pages copied and %.2f bytes changed per child\n",
+      (double)copied / (children ? children : 1), (double)changed / (children ? children : 1));
+
+  m8080_memory_free(&memory);
+  if(!isolated) {
+    fprintf(stderr, "a child's writes reached the parent\n");
+    return 1;
+  }
+  if(children && !changed) {
+    fprintf(stderr, "no child wrote to memory, try a ROM that does\n");
+    return 1;
+  }
+  return 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
@@ -0,0 +1,116 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+#define M8080_CPM_IMPLEMENTATION
+#include "m8080_cpm.h"
+#define M8080_HEAT_IMPLEMENTATION
+#include "m8080_heat.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// runs a CP/M program counting the accesses to every address, or to every
+// block of 1 << shift addresses, and writes them as PREFIX.csv and one image
+// per kind of access, PREFIX-read.pgm, PREFIX-write.pgm, PREFIX-fetch.pgm and
+// PREFIX-stack.pgm, then runs it again unmeasured to compare
+//
+//      $ ./heat roms/TST8080.COM tst
+//      $ ./heat roms/8080EXER.COM exer 8
+
+#define SLICE 100000
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool start(m8080_cpm* const cpm, m8080* const c, const char* const file) {
+  m8080_cpm_init(cpm, c);
+  cpm->out = NULL;
+  return m8080_cpm_load(cpm, file);
+}
+
+// the block with the most accesses of KIND
+static size_t hottest(const m8080_heat* const h, const int kind) {
+  size_t best = 0;
+  for(size_t i = 0; i < 0x10000 >> h->shift; ++i) {
+    if(h->count[kind][i] > h->count[kind][best]) best = i;
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  if(argc < 3 || argc > 4) {
+    fprintf(stderr, "usage: %s file prefix [shift]\n", argv[0]);
+    return 1;
+  }
+  const unsigned shift = argc > 3 ? strtoul(argv[3], NULL, 0) : 0;
+
+  static m8080_cpm cpm;
+  m8080 c;
+  if(!start(&cpm, &c, argv[1])) {
+    fprintf(stderr, "cannot open file: %s\n", argv[1]);
+    return 1;
+  }
+  m8080_heat h;
+  if(!m8080_heat_open(&h, &c, shift)) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  double time = now();
+  while(!cpm.done) m8080_heat_run(&h, &c, SLICE);
+  time = now() - time;
+  printf("measured:   %" PRIu64 " instructions, %" PRIu64 " cycles in %.3fs (%.2f MHz)\n",
+      h.instructions, c.cycles, time, c.cycles / time / 1e6);
+  const char* const kinds[M8080_HEAT_KINDS] = { "read", "write", "fetch", "stack" };
+  for(int i = 0; i < M8080_HEAT_KINDS; ++i) {
+    const size_t block = hottest(&h, i);
+    printf("most %-5s 0x%04zx (%" PRIu64 ")\n", kinds[i], block << h.shift, h.count[i][block]);
+  }
+  printf("stack between 0x%04x and 0x%04x\n", h.sp_min, h.sp_max);
+  const bool saved = m8080_heat_save(&h, argv[2]);
+  m8080_heat_close(&h, &c);
+  m8080_cpm_free(&cpm);
+  if(!saved) {
+    fprintf(stderr, "cannot write heatmap: %s\n", argv[2]);
+    return 1;
+  }
+
+  start(&cpm, &c, argv[1]);
+  double plain = now();
+  while(!cpm.done) m8080_run(&c, SLICE);
+  plain = now() - plain;
+  m8080_cpm_free(&cpm);
+  printf("unmeasured: %" PRIu64 " cycles in %.3fs (%.2f MHz), %.1fx faster\n",
+      c.cycles, plain, c.cycles / plain / 1e6, time / plain);
+  return 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
@@ -1,9 +1,16 @@
 /* Copyright (c) 2019 Pedro Minicz */
 #define M8080_IMPLEMENTATION
 #include "m8080.h"
+#define M8080_HEAT_IMPLEMENTATION
+#include "m8080_heat.h"
+#define M8080_PACE_IMPLEMENTATION
+#include "m8080_pace.h"
+#define M8080_SHIFT_IMPLEMENTATION
+#include "m8080_shift.h"
 
 #include <allegro5/allegro.h>
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,63 +18,44 @@
 
 typedef struct Invaders {
   uint8_t memory[0x10000];
-  uint8_t in1; // input port 1
+  // input port 1 has no handler, its value is kept up to date by the keyboard
+  // handler and read by the CPU directly
+  m8080_port port[256];
   // since the 8080 only includes instructions for bit shifting by one, space
   // invaders has bitshift hardware accessible on output ports 2 and 4 and
   // input port 3
-  uint16_t shift;
-  uint8_t shiftoffset;
+  m8080_shift shift;
 } Invaders;
 
 static ALLEGRO_BITMAP* bitmap;
 static ALLEGRO_DISPLAY* display;
 static ALLEGRO_EVENT_QUEUE* event_queue;
-static ALLEGRO_TIMER* timer;
 
-uint8_t m8080_rb(const m8080* const c, const uint16_t a) {
+static uint8_t invaders_rb(const m8080* const c, const uint16_t a) {
   const Invaders* const si = c->userdata;
   return si->memory[a];
 }
 
-void m8080_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+static void invaders_wb(m8080* const c, const uint16_t a, const uint8_t b) {
   Invaders* const si = c->userdata;
   // write outside RAM area
   if(a < 0x2000 || a > 0x3fff) return;
   si->memory[a] = b;
 }
 
-void m8080_in(m8080* const c, const uint8_t a) {
-  Invaders* const si = c->userdata;
-  switch(a) {
-  case 1: c->a = si->in1; break;
-  // reading port 3 returns the most significant eight bits of the shift
-  // register shifted to the left by the offset
-  case 3: c->a = si->shift >> (8 - si->shiftoffset); break;
-  // other ports are not implemented, return zero
-  default: c->a = 0;
-  }
-}
-
-void m8080_out(m8080* const c, const uint8_t a) {
-  Invaders* const si = c->userdata;
-  switch(a) {
-  // since the offset can be at most seven, only the least significant three
-  // bits of the accumulator are taken into account
-  case 2: si->shiftoffset = c->a & 0x07; break;
-  // shifts the least significant byte of the shift register to the left by one
-  // byte and adds the accumulator to the most significant byte
-  case 4: si->shift = c->a << 8 | si->shift >> 8; break;
-  }
-}
-
-// halt instruction
-void m8080_hlt(m8080* const c) {
-  exit(0);
-}
+// every port goes through the port table (`c->ports`) and halting only waits
+// for the next screen interrupt, so memory is all there is
+static const m8080_callbacks invaders_callbacks = {
+  .rb = invaders_rb,
+  .wb = invaders_wb,
+};
 
 static inline void invaders_init(Invaders* const si) {
   // bit 3 of input port 1 is always 1
-  si->in1 = 0x08;
+  si->port[1].value = 0x08;
+  // other ports are not implemented, reading them returns zero and writing
+  // them only updates their latch
+  m8080_shift_attach(&si->shift, si->port, 2, 4, 3);
   // this space invaders emulator expects the ROM to be in a single file which
   // is simply a concatenation of the separate ROM files
   //
@@ -92,15 +80,10 @@ static inline void invaders_al_init(void) {
   display = al_create_display(224, 256);
   if(!display) exit(1);
 
-  // timer for the screen interrupts
-  timer = al_create_timer(1.0 / 120.0);
-  if(!timer) exit(1);
-
   event_queue = al_create_event_queue();
   if(!event_queue) exit(1);
   al_register_event_source(event_queue, al_get_display_event_source(display));
   al_register_event_source(event_queue, al_get_keyboard_event_source());
-  al_register_event_source(event_queue, al_get_timer_event_source(timer));
 
   // the bitmap has to be stored on system memory since invaders_draw() writes
   // directly to it every frame having it on GPU memory would be slow
@@ -124,22 +107,23 @@ static inline void invaders_handle_keyboard(Invaders* const si, const ALLEGRO_EV
   //    bit 7 = always 0
   //
   // bit 3 is handled in invaders_init()
+  uint8_t* const in1 = &si->port[1].value;
   if(ev.type == ALLEGRO_EVENT_KEY_DOWN) {
     switch(ev.keyboard.keycode) {
-    case ALLEGRO_KEY_C: si->in1 |= 0x01; // coin
-    case ALLEGRO_KEY_ENTER: si->in1 |= 0x04; break; // player 1 start
-    case ALLEGRO_KEY_SPACE: si->in1 |= 0x10; break; // player 1 shoot
-    case ALLEGRO_KEY_LEFT: si->in1 |= 0x20; break; // player 1 left
-    case ALLEGRO_KEY_RIGHT: si->in1 |= 0x40; break; // player 1 right
+    case ALLEGRO_KEY_C: *in1 |= 0x01; // coin
+    case ALLEGRO_KEY_ENTER: *in1 |= 0x04; break; // player 1 start
+    case ALLEGRO_KEY_SPACE: *in1 |= 0x10; break; // player 1 shoot
+    case ALLEGRO_KEY_LEFT: *in1 |= 0x20; break; // player 1 left
+    case ALLEGRO_KEY_RIGHT: *in1 |= 0x40; break; // player 1 right
     }
   }
   else if(ev.type == ALLEGRO_EVENT_KEY_UP) {
     switch(ev.keyboard.keycode) {
-    case ALLEGRO_KEY_C: si->in1 &= ~0x01; // coin
-    case ALLEGRO_KEY_ENTER: si->in1 &= ~0x04; break; // player 1 start
-    case ALLEGRO_KEY_SPACE: si->in1 &= ~0x10; break; // player 1 shoot
-    case ALLEGRO_KEY_LEFT: si->in1 &= ~0x20; break; // player 1 left
-    case ALLEGRO_KEY_RIGHT: si->in1 &= ~0x40; break; // player 1 right
+    case ALLEGRO_KEY_C: *in1 &= ~0x01; // coin
+    case ALLEGRO_KEY_ENTER: *in1 &= ~0x04; break; // player 1 start
+    case ALLEGRO_KEY_SPACE: *in1 &= ~0x10; break; // player 1 shoot
+    case ALLEGRO_KEY_LEFT: *in1 &= ~0x20; break; // player 1 left
+    case ALLEGRO_KEY_RIGHT: *in1 &= ~0x40; break; // player 1 right
     }
   }
 }
@@ -190,48 +174,89 @@ static inline void invaders_draw(const m8080* const c, ALLEGRO_BITMAP* const bit
 }
 
 int main(int argc, char** argv) {
+  // emulation speed relative to the original hardware, 0 runs as fast as
+  // possible
+  const double speed = argc > 1 ? atof(argv[1]) : 1.0;
+  // memory accesses are counted when given a prefix for the heatmaps, which
+  // are written on exit
+  const char* const heat = argc > 2 ? argv[2] : NULL;
+
   Invaders si = {0};
   m8080 c = {0};
   c.userdata = &si;
+  c.cb = &invaders_callbacks;
+  c.ports = si.port;
+  // memory is plain RAM and ROM, so the loops waiting for the screen
+  // interrupts can be skipped
+  c.fast_forward = 1;
 
   invaders_init(&si);
   invaders_al_init();
 
-  uint16_t next_interrupt = M8080_RST_1;
-  al_start_timer(timer);
-  while(1) {
-    ALLEGRO_EVENT ev;
-    al_wait_for_event(event_queue, &ev);
-    if(ev.type == ALLEGRO_EVENT_DISPLAY_CLOSE) break;
+  // the ROM never changes (`invaders_wb` drops writes to it), so it is
+  // translated once from the reset and interrupt entry points and the
+  // translation kept for the next start
+  m8080_rom rom;
+  if(!m8080_rom_init(&rom, &c, 0x0000, 0x2000)) exit(1);
+  if(!m8080_rom_load(&rom, "roms/invaders.code")) {
+    m8080_rom_translate(&rom, &c, M8080_RST_0);
+    m8080_rom_translate(&rom, &c, M8080_RST_1);
+    m8080_rom_translate(&rom, &c, M8080_RST_2);
+    m8080_rom_save(&rom, "roms/invaders.code");
+  }
+
+  m8080_heat h;
+  if(heat && !m8080_heat_open(&h, &c, 0)) exit(1);
+
+  // emulated time is tied to the monotonic clock instead of to timer events,
+  // so a late frame is caught up on instead of stalling the game
+  m8080_pace pace;
+  m8080_pace_init(&pace, &c, M8080_HZ);
+  m8080_pace_speed(&pace, &c, speed);
 
-    invaders_handle_keyboard(&si, ev);
+  uint8_t next_interrupt = 1;
+  bool running = true;
+  while(running) {
+    ALLEGRO_EVENT ev;
+    while(al_get_next_event(event_queue, &ev)) {
+      if(ev.type == ALLEGRO_EVENT_DISPLAY_CLOSE) running = false;
+      invaders_handle_keyboard(&si, ev);
+    }
 
     // space invaders expects two screen interrupts every frame, RST 1 when the
     // screen is near the middle of the current frame and RST 2 when the screen
-    // finishes drawing it
-    if(ev.type == ALLEGRO_EVENT_TIMER) {
-      while(c.cycles < 2000000 / 120) m8080_step(&c);
-      c.cycles -= 2000000 / 120;
-
-      m8080_interrupt(&c, next_interrupt);
-      if(next_interrupt == M8080_RST_1) {
-        next_interrupt = M8080_RST_2;
-      } else {
-        // draw the screen at once on end-of-screen interrupt
-        next_interrupt = M8080_RST_1;
-        invaders_draw(&c, bitmap);
-        al_set_target_backbuffer(display);
-        al_draw_bitmap(bitmap, 0.f, 0.f, 0);
-        al_flip_display();
-      }
+    // finishes drawing it, a request made while interrupts are disabled waits
+    // for the game to enable them
+    if(heat) m8080_heat_run(&h, &c, M8080_HZ / 120);
+    else m8080_rom_run(&c, &rom, M8080_HZ / 120);
+
+    m8080_irq(&c, next_interrupt);
+    if(next_interrupt == 1) {
+      next_interrupt = 2;
+    } else {
+      // draw the screen at once on end-of-screen interrupt
+      next_interrupt = 1;
+      invaders_draw(&c, bitmap);
+      al_set_target_backbuffer(display);
+      al_draw_bitmap(bitmap, 0.f, 0.f, 0);
+      al_flip_display();
     }
+
+    m8080_pace_wait(&pace, &c);
   }
 
   al_destroy_bitmap(bitmap);
   al_destroy_event_queue(event_queue);
-  al_destroy_timer(timer);
   al_destroy_display(display);
 
+  if(heat) {
+    if(!m8080_heat_save(&h, heat)) fprintf(stderr, "cannot write heatmap: %s\n", heat);
+    m8080_heat_close(&h, &c);
+  }
+
+  // with whatever was translated while running
+  m8080_rom_save(&rom, "roms/invaders.code");
+  m8080_rom_free(&rom);
   return 0;
 }
 
@@ -0,0 +1,105 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+#define M8080_CPM_IMPLEMENTATION
+#include "m8080_cpm.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// counts how often each opcode follows each other in CP/M programs, the pairs
+// on top are the candidates for superinstructions in `m8080_run`
+
+// programs that run for longer are cut short so they don't drown the others
+#define STEPS 400000000
+#define TOP 20
+
+static uint64_t count[256][256];
+
+// lists the pair as it would be in memory, with zeros for the operands
+static void disassemble(m8080_cpm* const cpm, m8080* const c, const uint8_t first, const uint8_t second) {
+  memset(cpm->memory, 0, 6);
+  cpm->memory[0] = first;
+  const int size = m8080_disassemble(c, 0, false);
+  putchar('\n');
+  cpm->memory[size] = second;
+  m8080_disassemble(c, size, false);
+  putchar('\n');
+}
+
+int main(int argc, char** argv) {
+  if(argc < 2) {
+    fprintf(stderr, "usage: %s file...\n", argv[0]);
+    return 1;
+  }
+
+  static m8080_cpm cpm;
+  m8080 c;
+  uint64_t total = 0;
+  for(int i = 1; i < argc; ++i) {
+    m8080_cpm_init(&cpm, &c);
+    cpm.out = NULL;
+    if(!m8080_cpm_load(&cpm, argv[i])) {
+      fprintf(stderr, "cannot open file: %s\n", argv[i]);
+      return 1;
+    }
+    uint8_t previous = m8080_rb(&c, c.pc);
+    m8080_step(&c);
+    uint64_t steps = 1;
+    for(; !cpm.done && steps < STEPS; ++steps) {
+      const uint8_t opcode = m8080_rb(&c, c.pc);
+      ++count[previous][opcode];
+      previous = opcode;
+      m8080_step(&c);
+    }
+    m8080_cpm_free(&cpm);
+    printf("%s: %" PRIu64 " instructions\n", argv[i], steps);
+    total += steps;
+  }
+
+  m8080_cpm_init(&cpm, &c);
+  for(int n = 0; n < TOP; ++n) {
+    int first = 0;
+    int second = 0;
+    for(int i = 0; i < 256; ++i) {
+      for(int j = 0; j < 256; ++j) {
+        if(count[i][j] > count[first][second]) {
+          first = i;
+          second = j;
+        }
+      }
+    }
+    if(!count[first][second]) break;
+    printf("%.2f%%\n", 100.0 * count[first][second] / total);
+    disassemble(&cpm, &c, first, second);
+    count[first][second] = 0;
+  }
+  m8080_cpm_free(&cpm);
+  return 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
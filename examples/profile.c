@@ -0,0 +1,111 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+#define M8080_CPM_IMPLEMENTATION
+#include "m8080_cpm.h"
+#define M8080_PROFILE_IMPLEMENTATION
+#include "m8080_profile.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// profiles a CP/M program, prints the routines it spent the most cycles in
+// and, given a file, writes the call stacks for flame graph tools:
+//
+//      $ ./profile roms/8080EXER.COM exer.folded
+//      $ flamegraph.pl exer.folded >exer.svg
+
+// short, so that little of the last slice is spent halted after the exit
+#define SLICE 1000
+#define TOP 20
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+  if(argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s file [folded]\n", argv[0]);
+    return 1;
+  }
+
+  static m8080_cpm cpm;
+  m8080 c;
+  m8080_cpm_init(&cpm, &c);
+  cpm.out = NULL;
+  if(!m8080_cpm_load(&cpm, argv[1])) {
+    fprintf(stderr, "cannot open file: %s\n", argv[1]);
+    return 1;
+  }
+  m8080_profile p;
+  if(!m8080_profile_open(&p, &c)) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  double time = now();
+  while(!cpm.done) m8080_profile_run(&p, &c, SLICE);
+  time = now() - time;
+  m8080_cpm_free(&cpm);
+  printf("%" PRIu64 " instructions, %" PRIu64 " cycles in %.3fs (%.2f MHz)\n",
+      p.instructions, c.cycles, time, c.cycles / time / 1e6);
+  printf("%zu call chains, %" PRIu64 " calls too deep\n", p.count, p.dropped);
+
+  size_t count;
+  m8080_profile_routine* const routines = m8080_profile_routines(&p, &count);
+  if(!routines) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  printf("routine        calls   inclusive         exclusive\n");
+  uint64_t attributed = 0;
+  for(size_t i = 0; i < count; ++i) {
+    const m8080_profile_routine* const r = &routines[i];
+    attributed += r->exclusive;
+    if(i >= TOP) continue;
+    printf("0x%04x  %12" PRIu64 "  %6.2f%%  %6.2f%% %12" PRIu64 "\n", r->entry, r->calls,
+        100.0 * r->inclusive / c.cycles, 100.0 * r->exclusive / c.cycles, r->exclusive);
+  }
+  free(routines);
+
+  bool failed = false;
+  if(attributed != c.cycles) {
+    printf("%" PRIu64 " of %" PRIu64 " cycles attributed\n", attributed, c.cycles);
+    failed = true;
+  }
+  if(argc > 2 && !m8080_profile_folded(&p, argv[2])) {
+    fprintf(stderr, "cannot write call stacks: %s\n", argv[2]);
+    failed = true;
+  }
+  m8080_profile_close(&p);
+  return failed;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
@@ -0,0 +1,146 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+#define M8080_CPM_IMPLEMENTATION
+#include "m8080_cpm.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// runs a CP/M program as usual and again with the program translated ahead of
+// time as if it were ROM, then checks that both runs end in the same state
+//
+// the translation is never checked against memory, and the test programs keep
+// their variables in between their code and even patch it (CPUTEST and
+// 8080EXER do), so before translating, the program is run once more to find
+// the bytes it writes, which are then left out of the translation
+
+// a slice, long enough for the loop around it not to matter
+#define SLICE 100000
+
+static uint8_t written[0x10000];
+
+static void probe_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  m8080_cpm* const cpm = c->userdata;
+  written[a] = 1;
+  cpm->memory[a] = b;
+}
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool start(m8080_cpm* const cpm, m8080* const c, const char* const file) {
+  m8080_cpm_init(cpm, c);
+  cpm->out = NULL;
+  cpm->capture = true;
+  return m8080_cpm_load(cpm, file);
+}
+
+int main(int argc, char** argv) {
+  if(argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s file [cache]\n", argv[0]);
+    return 1;
+  }
+  const char* const cache = argc > 2 ? argv[2] : NULL;
+
+  FILE* const f = fopen(argv[1], "rb");
+  if(!f) {
+    fprintf(stderr, "cannot open file: %s\n", argv[1]);
+    return 1;
+  }
+  fseek(f, 0, SEEK_END);
+  const long size = ftell(f);
+  fclose(f);
+
+  static m8080_cpm cpm;
+  m8080 c;
+  start(&cpm, &c, argv[1]);
+  double time = now();
+  while(!cpm.done) m8080_run(&c, SLICE);
+  time = now() - time;
+  const m8080 expected = c;
+  char* const log = cpm.log;
+  const size_t log_size = cpm.log_size;
+  cpm.log = NULL;
+  m8080_cpm_free(&cpm);
+  printf("fetched:    %" PRIu64 " cycles in %.3fs (%.2f MHz)\n",
+      c.cycles, time, c.cycles / time / 1e6);
+
+  start(&cpm, &c, argv[1]);
+  m8080_rom rom;
+  if(!m8080_rom_init(&rom, &c, 0x0100, size)) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  time = now();
+  if(cache && m8080_rom_load(&rom, cache)) {
+    printf("loaded %s in %.6fs\n", cache, now() - time);
+  } else {
+    m8080_callbacks probe = m8080_cpm_callbacks;
+    probe.wb = probe_wb;
+    c.cb = &probe;
+    while(!cpm.done) m8080_run(&c, SLICE);
+    m8080_cpm_free(&cpm);
+    start(&cpm, &c, argv[1]);
+
+    for(size_t a = 0x0100; a < 0x0100 + (size_t)size && a < 0x10000; ++a) {
+      if(written[a]) m8080_rom_forget(&rom, a);
+    }
+    const size_t n = m8080_rom_translate(&rom, &c, 0x0100);
+    printf("probed and translated %zu instructions in %.6fs\n", n, now() - time);
+  }
+
+  time = now();
+  while(!cpm.done) m8080_rom_run(&c, &rom, SLICE);
+  time = now() - time;
+  printf("translated: %" PRIu64 " cycles in %.3fs (%.2f MHz)\n",
+      c.cycles, time, c.cycles / time / 1e6);
+  // saved after the run so that code only found while running is kept too
+  if(cache && !m8080_rom_save(&rom, cache)) {
+    fprintf(stderr, "cannot write cache: %s\n", cache);
+  }
+
+  const bool same = c.cycles == expected.cycles && c.pc == expected.pc
+    && c.sp == expected.sp && c.psw == expected.psw && c.bc == expected.bc
+    && c.de == expected.de && c.hl == expected.hl
+    && cpm.log_size == log_size && !memcmp(cpm.log, log, log_size);
+  free(log);
+  m8080_cpm_free(&cpm);
+  m8080_rom_free(&rom);
+  if(!same) {
+    printf("the runs ended in different states\n");
+    return 1;
+  }
+  return 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
@@ -0,0 +1,239 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+#define M8080_PERF_IMPLEMENTATION
+#include "m8080_perf.h"
+#define M8080_SHIFT_IMPLEMENTATION
+#include "m8080_shift.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// draws 64 sprites per frame with a routine modeled after the one space
+// invaders uses, every row of a sprite costs two writes to the shift register
+// and two reads of the result
+static const uint8_t frame[] = {
+  0x0e, 0x40,             // 0x0000 mvi c, 64
+  0x21, 0x00, 0x24,       // 0x0002 lxi h, 0x2400
+  0x79,                   // 0x0005 mov a, c
+  0xe6, 0x07,             // 0x0006 ani 7
+  0xd3, 0x02,             // 0x0008 out 2
+  0x11, 0x00, 0x01,       // 0x000a lxi d, sprite
+  0x06, 0x08,             // 0x000d mvi b, 8
+  0xe5,                   // 0x000f push h
+  0xcd, 0x00, 0x02,       // 0x0010 call draw
+  0xe1,                   // 0x0013 pop h
+  0x11, 0x41, 0x00,       // 0x0014 lxi d, 0x0041
+  0x19,                   // 0x0017 dad d
+  0x0d,                   // 0x0018 dcr c
+  0xc2, 0x05, 0x00,       // 0x0019 jnz 0x0005
+  0x76,                   // 0x001c hlt
+};
+
+static const uint8_t sprite[] = {
+  0x18, 0x3c, 0x7e, 0xdb, 0xff, 0x24, 0x5a, 0xa5,
+};
+
+static const uint8_t draw[] = {
+  0xc5,                   // 0x0200 push b
+  0xe5,                   // 0x0201 push h
+  0x1a,                   // 0x0202 ldax d
+  0xd3, 0x04,             // 0x0203 out 4
+  0xdb, 0x03,             // 0x0205 in 3
+  0xb6,                   // 0x0207 ora m
+  0x77,                   // 0x0208 mov m, a
+  0x23,                   // 0x0209 inx h
+  0x13,                   // 0x020a inx d
+  0xaf,                   // 0x020b xra a
+  0xd3, 0x04,             // 0x020c out 4
+  0xdb, 0x03,             // 0x020e in 3
+  0xb6,                   // 0x0210 ora m
+  0x77,                   // 0x0211 mov m, a
+  0xe1,                   // 0x0212 pop h
+  0x01, 0x20, 0x00,       // 0x0213 lxi b, 0x0020
+  0x09,                   // 0x0216 dad b
+  0xc1,                   // 0x0217 pop b
+  0x05,                   // 0x0218 dcr b
+  0xc2, 0x00, 0x02,       // 0x0219 jnz 0x0200
+  0xc9,                   // 0x021c ret
+};
+
+typedef struct Bench {
+  uint8_t memory[0x10000];
+  m8080_port port[256];
+  // used by the `in`/`out` callbacks and the port handlers
+  uint16_t shift;
+  uint8_t shiftoffset;
+  // used by the port table device
+  m8080_shift device;
+} Bench;
+
+static uint8_t bench_rb(const m8080* const c, const uint16_t a) {
+  const Bench* const b = c->userdata;
+  return b->memory[a];
+}
+
+static void bench_wb(m8080* const c, const uint16_t a, const uint8_t v) {
+  Bench* const b = c->userdata;
+  b->memory[a] = v;
+}
+
+static inline void bench_shift_write(Bench* const b, const uint8_t a, const uint8_t v) {
+  switch(a) {
+  case 2: b->shiftoffset = v & 0x07; break;
+  case 4: b->shift = v << 8 | b->shift >> 8; break;
+  }
+}
+
+// how space invaders did it before the port table: one callback for every
+// port, a `switch` and the machine state through `userdata`
+static void bench_in(m8080* const c, const uint8_t a) {
+  const Bench* const b = c->userdata;
+  switch(a) {
+  case 3: c->a = b->shift >> (8 - b->shiftoffset); break;
+  default: c->a = 0; break;
+  }
+}
+
+static void bench_out(m8080* const c, const uint8_t a) {
+  bench_shift_write(c->userdata, a, c->a);
+}
+
+// the same thing as port handlers
+static uint8_t bench_shift_in(m8080* const c, void* const ctx, const uint8_t a) {
+  const Bench* const b = ctx;
+  return b->shift >> (8 - b->shiftoffset);
+}
+
+static void bench_shift_out(m8080* const c, void* const ctx, const uint8_t a, const uint8_t v) {
+  bench_shift_write(ctx, a, v);
+}
+
+static const m8080_callbacks callbacks = {
+  .rb = bench_rb,
+  .wb = bench_wb,
+  .in = bench_in,
+  .out = bench_out,
+};
+
+enum { CALLBACKS, HANDLERS, DEVICE };
+
+static const char* const names[] = {
+  [CALLBACKS] = "in/out callbacks",
+  [HANDLERS] = "port handlers",
+  [DEVICE] = "shift register device",
+};
+
+static inline double seconds(const clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// runs `frames` frames and returns the time it took, every frame is a slice
+// for the host counters
+static double run(Bench* const b, const int mode, const size_t frames, uint64_t* const cycles,
+    m8080_perf* const perf) {
+  memset(b, 0, sizeof(*b));
+  memcpy(b->memory + 0x0000, frame, sizeof(frame));
+  memcpy(b->memory + 0x0100, sprite, sizeof(sprite));
+  memcpy(b->memory + 0x0200, draw, sizeof(draw));
+
+  m8080 c = {0};
+  c.userdata = b;
+  c.cb = &callbacks;
+  c.sp = 0xf000;
+
+  switch(mode) {
+  case HANDLERS:
+    b->port[2].out = bench_shift_out;
+    b->port[2].ctx = b;
+    b->port[3].in = bench_shift_in;
+    b->port[3].ctx = b;
+    b->port[4].out = bench_shift_out;
+    b->port[4].ctx = b;
+    c.ports = b->port;
+    break;
+  case DEVICE:
+    m8080_shift_attach(&b->device, b->port, 2, 4, 3);
+    c.ports = b->port;
+    break;
+  }
+
+  const clock_t start = clock();
+  for(size_t i = 0; i < frames; ++i) {
+    c.pc = 0x0000;
+    c.halted = 0;
+    m8080_perf_begin(perf, &c);
+    while(!c.halted) m8080_step(&c);
+    m8080_perf_end(perf, &c);
+  }
+  *cycles = c.cycles;
+  return seconds(start);
+}
+
+int main(int argc, char** argv) {
+  if(argc > 2) {
+    fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+    return 1;
+  }
+  const size_t frames = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000;
+
+  static Bench b;
+  static uint8_t screen[0x2000];
+  // 64 sprites of 8 rows, each with two `out 4` and two `in 3`, plus one
+  // `out 2` per sprite
+  const size_t io = 64 * (8 * 4 + 1);
+  int mismatch = 0;
+  m8080_perf perf;
+  const bool counters = m8080_perf_open(&perf);
+
+  printf("frames: %zu, I/O instructions per frame: %zu\n", frames, io);
+  for(int mode = CALLBACKS; mode <= DEVICE; ++mode) {
+    uint64_t cycles;
+    m8080_perf_reset(&perf);
+    const double time = run(&b, mode, frames, &cycles, &perf);
+    printf("%-22s %.3fs, %.2f MHz, %.2f us per frame\n",
+        names[mode], time, cycles / time / 1e6, time * 1e6 / frames);
+    if(counters) {
+      printf("  ");
+      m8080_perf_print(&perf, stdout);
+    }
+    // every way of dispatching must draw the same screen
+    if(mode == CALLBACKS) {
+      memcpy(screen, b.memory + 0x2000, sizeof(screen));
+      mismatch = screen[0x0400] != sprite[0]; // the first sprite has no offset
+    } else if(memcmp(screen, b.memory + 0x2000, sizeof(screen))) {
+      printf("%s: screen differs\n", names[mode]);
+      mismatch = 1;
+    }
+  }
+  if(!counters) printf("host performance counters unavailable\n");
+  m8080_perf_close(&perf);
+  return mismatch;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
@@ -1,74 +1,304 @@
 /* Copyright (c) 2019 Pedro Minicz */
+// the callbacks are linked directly so that they can be inlined into
+// `m8080_step`, which matters for the cycle-heavy test ROMs
+#define M8080_EXTERN_CALLBACKS
 #define M8080_IMPLEMENTATION
 #include "m8080.h"
+#define M8080_CPM_IMPLEMENTATION
+#include "m8080_cpm.h"
 
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+typedef struct Machine {
+  m8080_cpm cpm; // first, so `userdata` is the CP/M machine too
+  uint64_t end; // the cycle count when the CPU halted
+} Machine;
+
+// the memory of a CP/M machine is the first thing in it
 uint8_t m8080_rb(const m8080* const c, const uint16_t a) {
-  const uint8_t* const memory = c->userdata;
-  return memory[a];
+  const m8080_cpm* const cpm = c->userdata;
+  return cpm->memory[a];
 }
 
 void m8080_wb(m8080* const c, const uint16_t a, const uint8_t b) {
-  uint8_t* const memory = c->userdata;
-  memory[a] = b;
+  m8080_cpm* const cpm = c->userdata;
+  cpm->memory[a] = b;
 }
 
 void m8080_in(m8080* const c, const uint8_t a) { }
 void m8080_out(m8080* const c, const uint8_t a) { }
 
+// a test ROM halting is done as well, programs that exit halt right after,
+// the count is taken here since `m8080_run` counts the rest of its slice as
+// hlt instructions
 void m8080_hlt(m8080* const c) {
-  c->pc = 0;
+  Machine* const m = c->userdata;
+  m->cpm.done = true;
+  m->end = c->cycles;
 }
 
-static inline size_t test(const char* const file) {
-  puts(file);
-
-  m8080 c = {0};
-  uint8_t memory[0x10000] = {0};
-  c.userdata = memory;
-  c.pc = 0x0100; // the test ROMs expect to be loaded at 0x0100
-
-  FILE* f = fopen(file, "rb");
-  if(!f) return 0;
-  fread(memory + c.pc, 1, sizeof(memory) - c.pc, f);
-  fclose(f);
-
-  // the test ROMs expect a print function to be located at 0x0005
-  memory[0x0005] = 0xc9; // RET
-
-  while(1) {
-    const uint16_t previous_pc = c.pc;
-    m8080_step(&c);
-
-    // handle CALL 0005
-    if(c.pc == 0x0005) {
-      // prints memory from DE until '$' is found
-      if(c.c == 0x09) {
-        for(uint16_t i = c.de; m8080_rb(&c, i) != '$'; ++i) {
-          putchar(m8080_rb(&c, i));
-        }
-      }
-      if(c.c == 0x02) putchar(c.e);
-    }
-    if(c.pc == 0) {
-      printf("\njumped to 0000 from %04x (%zu cycles)\n\n", previous_pc, c.cycles);
-      return c.cycles;
-    }
+// 8080EXER walks a zero terminated table of tests at this address, a single
+// test runs by leaving only its entry in the table
+#define EXER_TABLE 0x013a
+
+// every test runs twice, one instruction at a time through `m8080_step` and
+// in slices through `m8080_run`, which runs superinstructions, both must pass
+// in the same number of cycles
+enum { STEP, RUN, PASSES };
+
+#define SLICE 1000000
+
+// filled in by the worker that runs the test
+typedef struct Result {
+  bool pass;
+  const char* error; // why the test couldn't run at all
+  uint64_t cycles;
+  double time;
+  char* log;
+  size_t log_size;
+} Result;
+
+typedef struct Test {
+  const char* name;
+  const char* file;
+  int exer; // index in the 8080EXER table, -1 to run the whole ROM
+  const char* expected; // a line the console output must contain
+  Result result[PASSES];
+} Test;
+
+// the 8080EXER lines are the ones printed when the CRC of the test matches
+// the one stored in the ROM, on a mismatch it prints both of them instead
+static Test tests[] = {
+  { "TST8080", "roms/TST8080.COM", -1, "CPU IS OPERATIONAL" },
+  { "CPUTEST", "roms/CPUTEST.COM", -1, "CPU TESTS OK" },
+  { "8080PRE", "roms/8080PRE.COM", -1, "8080 Preliminary tests complete" },
+  { "8080EXER 0", "roms/8080EXER.COM", 0, "dad <b,d,h,sp>................  OK" },
+  { "8080EXER 1", "roms/8080EXER.COM", 1, "aluop nn......................  OK" },
+  { "8080EXER 2", "roms/8080EXER.COM", 2, "aluop <b,c,d,e,h,l,m,a>.......  OK" },
+  { "8080EXER 3", "roms/8080EXER.COM", 3, "<daa,cma,stc,cmc>.............  OK" },
+  { "8080EXER 4", "roms/8080EXER.COM", 4, "<inr,dcr> a...................  OK" },
+  { "8080EXER 5", "roms/8080EXER.COM", 5, "<inr,dcr> b...................  OK" },
+  { "8080EXER 6", "roms/8080EXER.COM", 6, "<inx,dcx> b...................  OK" },
+  { "8080EXER 7", "roms/8080EXER.COM", 7, "<inr,dcr> c...................  OK" },
+  { "8080EXER 8", "roms/8080EXER.COM", 8, "<inr,dcr> d...................  OK" },
+  { "8080EXER 9", "roms/8080EXER.COM", 9, "<inx,dcx> d...................  OK" },
+  { "8080EXER 10", "roms/8080EXER.COM", 10, "<inr,dcr> e...................  OK" },
+  { "8080EXER 11", "roms/8080EXER.COM", 11, "<inr,dcr> h...................  OK" },
+  { "8080EXER 12", "roms/8080EXER.COM", 12, "<inx,dcx> h...................  OK" },
+  { "8080EXER 13", "roms/8080EXER.COM", 13, "<inr,dcr> l...................  OK" },
+  { "8080EXER 14", "roms/8080EXER.COM", 14, "<inr,dcr> m...................  OK" },
+  { "8080EXER 15", "roms/8080EXER.COM", 15, "<inx,dcx> sp..................  OK" },
+  { "8080EXER 16", "roms/8080EXER.COM", 16, "lhld nnnn.....................  OK" },
+  { "8080EXER 17", "roms/8080EXER.COM", 17, "shld nnnn.....................  OK" },
+  { "8080EXER 18", "roms/8080EXER.COM", 18, "lxi <b,d,h,sp>,nnnn...........  OK" },
+  { "8080EXER 19", "roms/8080EXER.COM", 19, "ldax <b,d>....................  OK" },
+  { "8080EXER 20", "roms/8080EXER.COM", 20, "mvi <b,c,d,e,h,l,m,a>,nn......  OK" },
+  { "8080EXER 21", "roms/8080EXER.COM", 21, "mov <bcdehla>,<bcdehla>.......  OK" },
+  { "8080EXER 22", "roms/8080EXER.COM", 22, "sta nnnn / lda nnnn...........  OK" },
+  { "8080EXER 23", "roms/8080EXER.COM", 23, "<rlc,rrc,ral,rar>.............  OK" },
+  { "8080EXER 24", "roms/8080EXER.COM", 24, "stax <b,d>....................  OK" },
+};
+
+#define TESTS (sizeof(tests) / sizeof(*tests))
+
+// small loops at 0x0100 that `m8080_run` with `fast_forward` set must leave
+// in the same state as stepping through them, whether they are skipped
+// because they are idle or not
+typedef struct Loop {
+  const char* name;
+  uint8_t code[8];
+  size_t size;
+  bool idle; // a long slice of it must take no time at all
+} Loop;
+
+static const Loop loops[] = {
+  { "jmp $", { 0xc3, 0x00, 0x01 }, 3, true },
+  { "nop; jmp", { 0x00, 0xc3, 0x00, 0x01 }, 4, true },
+  { "inr b; jmp", { 0x04, 0xc3, 0x00, 0x01 }, 4, false },
+  { "sta; jmp", { 0x32, 0x00, 0x90, 0xc3, 0x00, 0x01 }, 6, false },
+};
+
+#define LOOPS (sizeof(loops) / sizeof(*loops))
+// stepped through to compare, and the slice an idle loop must skip
+#define LOOP_CYCLES 1000003
+#define IDLE_CYCLES 100000000000
+
+// index of the next test a worker should take
+static atomic_size_t next;
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// CPUTEST prints zeros, so the log isn't a string
+static bool contains(const char* const log, const size_t size, const char* const s) {
+  const size_t n = strlen(s);
+  for(size_t i = 0; i + n <= size; ++i) {
+    if(!memcmp(log + i, s, n)) return true;
+  }
+  return false;
+}
+
+static void run(Test* const t, const int pass) {
+  Result* const r = &t->result[pass];
+  Machine* const m = malloc(sizeof(Machine));
+  if(!m) {
+    r->error = "out of memory";
+    return;
+  }
+  m8080_cpm* const cpm = &m->cpm;
+  m8080 c;
+  m8080_cpm_init(cpm, &c);
+  // every machine keeps its output to itself
+  cpm->out = NULL;
+  cpm->capture = true;
+  if(!m8080_cpm_load(cpm, t->file)) {
+    r->error = "cannot load the ROM";
+    free(m);
+    return;
+  }
+
+  if(t->exer >= 0) {
+    uint8_t* const table = cpm->memory + EXER_TABLE;
+    memmove(table, table + 2 * t->exer, 2);
+    table[2] = 0x00;
+    table[3] = 0x00;
+  }
+
+  const double start = now();
+  if(pass == STEP) {
+    while(!c.halted) m8080_step(&c);
+  } else {
+    // reading CP/M memory has no side effects, so pairs are fused
+    c.fast_forward = 1;
+    while(!c.halted) m8080_run(&c, SLICE);
   }
+  r->time = now() - start;
+  r->cycles = m->end;
+
+  // the log is handed over to the test before freeing the machine
+  r->log = cpm->log;
+  r->log_size = cpm->log_size;
+  cpm->log = NULL;
+  r->pass = contains(r->log, r->log_size, t->expected);
+  m8080_cpm_free(cpm);
+  free(m);
+}
+
+static void loop_start(Machine* const m, m8080* const c, const Loop* const l) {
+  m8080_cpm_init(&m->cpm, c);
+  memcpy(m->cpm.memory + 0x0100, l->code, l->size);
+  c->fast_forward = 1;
+}
+
+static bool loop_check(const Loop* const l) {
+  Machine* const m = malloc(2 * sizeof(Machine));
+  if(!m) return false;
+  m8080 stepped, ran;
+  loop_start(&m[0], &stepped, l);
+  loop_start(&m[1], &ran, l);
+  while(stepped.cycles < LOOP_CYCLES) m8080_step(&stepped);
+  m8080_run_until(&ran, LOOP_CYCLES);
+  bool pass = stepped.cycles == ran.cycles && stepped.pc == ran.pc && stepped.sp == ran.sp
+    && stepped.psw == ran.psw && stepped.bc == ran.bc && stepped.de == ran.de
+    && stepped.hl == ran.hl && !memcmp(m[0].cpm.memory, m[1].cpm.memory, 0x10000);
+  if(l->idle) {
+    // stepping through it would take about a minute
+    const double start = now();
+    m8080_run_until(&ran, IDLE_CYCLES);
+    pass &= ran.cycles >= IDLE_CYCLES && now() - start < 1.0;
+  }
+  m8080_cpm_free(&m[0].cpm);
+  m8080_cpm_free(&m[1].cpm);
+  free(m);
+  return pass;
+}
+
+// all the tests are taken with `m8080_step` before any with `m8080_run`, so
+// the long ones don't all end up last
+static void* worker(void* const arg) {
+  size_t i;
+  while((i = atomic_fetch_add(&next, 1)) < TESTS * PASSES) run(&tests[i % TESTS], i / TESTS);
+  return NULL;
 }
 
 int main(int argc, char** argv) {
-  size_t cycles = 0;
-  cycles += test("roms/TST8080.COM");
-  cycles += test("roms/CPUTEST.COM");
-  cycles += test("roms/8080PRE.COM");
-  cycles += test("roms/8080EXER.COM");
-  printf("total cycles: %zu\n", cycles);
-
-  return 0;
+  bool verbose = false;
+  if(argc > 1 && !strcmp(argv[1], "-v")) {
+    verbose = true;
+    --argc;
+    ++argv;
+  }
+  if(argc > 2) {
+    fprintf(stderr, "usage: tests [-v] [threads]\n");
+    return 1;
+  }
+  long threads = argc > 1 ? strtol(argv[1], NULL, 0) : sysconf(_SC_NPROCESSORS_ONLN);
+  if(threads < 1) threads = 1;
+  if(threads > TESTS * PASSES) threads = TESTS * PASSES;
+
+  pthread_t* const thread = malloc(threads * sizeof(pthread_t));
+  if(!thread) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  const double start = now();
+  long started = 0;
+  while(started < threads && !pthread_create(&thread[started], NULL, worker, NULL)) ++started;
+  // the tests left for the threads that couldn't be started run here
+  if(started < threads) {
+    fprintf(stderr, "could only start %ld of %ld threads\n", started, threads);
+    threads = started + 1;
+    worker(NULL);
+  }
+  for(long i = 0; i < started; ++i) pthread_join(thread[i], NULL);
+  const double time = now() - start;
+  free(thread);
+
+  const char* const passes[PASSES] = { "step", "run" };
+  size_t passed = 0;
+  uint64_t cycles = 0;
+  for(size_t i = 0; i < TESTS; ++i) {
+    Test* const t = &tests[i];
+    for(int pass = 0; pass < PASSES; ++pass) {
+      Result* const r = &t->result[pass];
+      const bool differ = r->cycles != t->result[STEP].cycles;
+      r->pass &= !differ;
+      printf("%-12s %-4s %s %12" PRIu64 " cycles %8.3fs %8.2f MHz\n", t->name, passes[pass],
+          r->pass ? "pass" : "FAIL", r->cycles, r->time,
+          r->time > 0 ? r->cycles / r->time / 1e6 : 0.0);
+      if(r->error) printf("%s: %s\n", r->error, t->file);
+      else if(differ) printf("%" PRIu64 " cycles with m8080_step\n", t->result[STEP].cycles);
+      if(verbose || !r->pass) {
+        fwrite(r->log, 1, r->log_size, stdout);
+        putchar('\n');
+      }
+      passed += r->pass;
+      cycles += r->cycles;
+      free(r->log);
+    }
+  }
+  for(size_t i = 0; i < LOOPS; ++i) {
+    const bool pass = loop_check(&loops[i]);
+    printf("%-17s %s\n", loops[i].name, pass ? "pass" : "FAIL");
+    passed += pass;
+  }
+  printf("%zu/%zu passed, %" PRIu64 " cycles in %.3fs on %ld threads (%.2f MHz)\n",
+      passed, TESTS * PASSES + LOOPS, cycles, time, threads, cycles / time / 1e6);
+
+  return passed != TESTS * PASSES + LOOPS;
 }
 
 /*
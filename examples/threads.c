@@ -0,0 +1,131 @@
+/* Copyright (c) 2019 Pedro Minicz */
+// the callbacks are linked directly so that the threads spend their time in
+// `m8080_step` and not calling out
+#define M8080_EXTERN_CALLBACKS
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint8_t m8080_rb(const m8080* const c, const uint16_t a) {
+  const uint8_t* const memory = c->userdata;
+  return memory[a];
+}
+
+void m8080_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  uint8_t* const memory = c->userdata;
+  memory[a] = b;
+}
+
+void m8080_in(m8080* const c, const uint8_t a) { }
+void m8080_out(m8080* const c, const uint8_t a) { }
+
+void m8080_hlt(m8080* const c) { }
+
+#define MAX_THREADS 64
+
+static uint8_t rom[0x10000 - 0x0100];
+static size_t len;
+static uint64_t cycles;
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* run(void* const arg) {
+  m8080* const c = arg;
+  while(c->cycles < cycles) m8080_step(c);
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  if(argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s file [cycles]\n", argv[0]);
+    return 1;
+  }
+  cycles = argc > 2 ? strtoull(argv[2], NULL, 0) : 200000000;
+
+  FILE* f = fopen(argv[1], "rb");
+  if(!f) {
+    fprintf(stderr, "cannot open file: %s\n", argv[1]);
+    return 1;
+  }
+  len = fread(rom, 1, sizeof(rom), f);
+  fclose(f);
+
+  // the machines are next to each other, like in a batch runner, which is
+  // where sharing cache lines would hurt
+  m8080* const machines = aligned_alloc(M8080_CACHE_LINE, MAX_THREADS * sizeof(m8080));
+  uint8_t* const memory = malloc((size_t)MAX_THREADS * 0x10000);
+  if(!machines || !memory) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  printf("sizeof(m8080): %zu, cycles per thread: %" PRIu64 "\n", sizeof(m8080), cycles);
+  static const size_t counts[] = { 1, 8, 64 };
+  for(size_t i = 0; i < sizeof(counts) / sizeof(*counts); ++i) {
+    const size_t threads = counts[i];
+    pthread_t thread[MAX_THREADS];
+
+    for(size_t j = 0; j < threads; ++j) {
+      uint8_t* const m = memory + j * 0x10000;
+      memset(m, 0, 0x10000);
+      memcpy(m + 0x0100, rom, len);
+      // restart the ROM when it is done and ignore printing
+      m[0x0000] = 0xc3; // jmp 0x0100
+      m[0x0001] = 0x00;
+      m[0x0002] = 0x01;
+      m[0x0005] = 0xc9; // ret
+      memset(&machines[j], 0, sizeof(m8080));
+      machines[j].userdata = m;
+      machines[j].pc = 0x0100;
+    }
+
+    const double start = now();
+    for(size_t j = 0; j < threads; ++j) {
+      pthread_create(&thread[j], NULL, run, &machines[j]);
+    }
+    for(size_t j = 0; j < threads; ++j) pthread_join(thread[j], NULL);
+    const double time = now() - start;
+
+    printf("%2zu threads: %.3fs, %.2f MHz total, %.2f MHz per thread\n",
+        threads, time, threads * cycles / time / 1e6, cycles / time / 1e6);
+  }
+
+  free(machines);
+  free(memory);
+  return 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
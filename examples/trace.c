@@ -0,0 +1,269 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+#define M8080_CPM_IMPLEMENTATION
+#include "m8080_cpm.h"
+#define M8080_TRACE_IMPLEMENTATION
+#include "m8080_trace.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// traces a CP/M program, then reads the trace back while running the program
+// again untraced and checks that every instruction and the bytes it wrote
+// match, then does the same for a small program taking interrupts
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool start(m8080_cpm* const cpm, m8080* const c, const char* const file) {
+  m8080_cpm_init(cpm, c);
+  cpm->out = NULL;
+  return m8080_cpm_load(cpm, file);
+}
+
+// the bytes written by the instruction being replayed, seen by wrapping the
+// `wb` of the machine
+static m8080_trace_record written;
+static const m8080_callbacks* replay_user;
+static m8080_callbacks replay_callbacks;
+
+static void replay_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  if(written.writes < M8080_TRACE_WRITES) {
+    written.write_address[written.writes] = a;
+    written.write_value[written.writes] = b;
+  }
+  ++written.writes;
+  replay_user->wb(c, a, b);
+}
+
+static void watch(m8080* const c) {
+  replay_user = c->cb;
+  replay_callbacks = *c->cb;
+  replay_callbacks.wb = replay_wb;
+  c->cb = &replay_callbacks;
+}
+
+static bool replay(m8080_cpm* const cpm, m8080* const c, const char* const file) {
+  if(!start(cpm, c, file)) return false;
+  watch(c);
+  return true;
+}
+
+static void step(m8080* const c) {
+  written.writes = 0;
+  m8080_step(c);
+}
+
+// the registers after the instruction and, if `writes` is set, the bytes it
+// wrote
+static bool same(const m8080_trace_record* const rec, const m8080* const c, const bool writes) {
+  if(writes) {
+    if(rec->writes != written.writes) return false;
+    for(size_t i = 0; i < rec->writes && i < M8080_TRACE_WRITES; ++i) {
+      if(rec->write_address[i] != written.write_address[i]
+          || rec->write_value[i] != written.write_value[i]) return false;
+    }
+  }
+  return rec->cycles == c->cycles && rec->pc == c->pc && rec->sp == c->sp
+    && rec->psw == c->psw && rec->bc == c->bc && rec->de == c->de
+    && rec->hl == c->hl && rec->inte == c->inte && rec->halted == c->halted;
+}
+
+static uint8_t memory[0x10000];
+
+static uint8_t flat_rb(const m8080* const c, const uint16_t a) {
+  return memory[a];
+}
+
+static void flat_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  memory[a] = b;
+}
+
+static const m8080_callbacks flat_callbacks = { .rb = flat_rb, .wb = flat_wb };
+
+// a loop with interrupts enabled and a handler at rst 1 counting them in
+// memory, the return addresses pushed by `m8080_interrupt` between two steps
+// belong to the record of the next one
+static void interrupted(m8080* const c) {
+  static const uint8_t program[] = {
+    0xfb, //       ei
+    0x00, // loop: nop
+    0xc3, 0x01, 0x00, // jmp loop
+    0x00, 0x00, 0x00,
+    0x3c, //       inr a
+    0x32, 0x00, 0x90, // sta 0x9000
+    0xfb, //       ei
+    0xc9, //       ret
+  };
+  memset(memory, 0, sizeof(memory));
+  memcpy(memory, program, sizeof(program));
+  memset(c, 0, sizeof(*c));
+  c->cb = &flat_callbacks;
+  c->sp = 0x8000;
+}
+
+#define INTERRUPTED_STEPS 1000
+
+// every tenth step is preceded by an interrupt, if they are enabled
+static inline void interrupt(m8080* const c, const size_t i) {
+  if(i % 10 == 5) m8080_interrupt(c, M8080_RST_1);
+}
+
+static bool interrupts(const char* const path) {
+  m8080 c;
+  interrupted(&c);
+  m8080_trace t;
+  if(!m8080_trace_open(&t, &c, path, false)) return false;
+  for(size_t i = 0; i < INTERRUPTED_STEPS; ++i) {
+    interrupt(&c, i);
+    m8080_trace_step(&t, &c);
+  }
+  if(!m8080_trace_close(&t, &c)) return false;
+
+  m8080_trace_reader r;
+  if(!m8080_trace_reader_open(&r, path)) return false;
+  interrupted(&c);
+  watch(&c);
+  m8080_trace_record rec;
+  size_t read = 0;
+  bool replayed = true;
+  for(; replayed && m8080_trace_next(&r, &rec); ++read) {
+    interrupt(&c, read);
+    m8080_step(&c);
+    replayed = same(&rec, &c, true);
+    written.writes = 0;
+  }
+  m8080_trace_reader_close(&r);
+  remove(path);
+  printf("%u interrupts replayed\n", memory[0x9000]);
+  return replayed && read == INTERRUPTED_STEPS && memory[0x9000];
+}
+
+int main(int argc, char** argv) {
+  if(argc < 3 || argc > 4 || (argc == 4 && strcmp(argv[3], "-z"))) {
+    fprintf(stderr, "usage: %s file trace [-z]\n", argv[0]);
+    return 1;
+  }
+  const bool compress = argc == 4;
+
+  static m8080_cpm cpm;
+  m8080 c;
+  if(!start(&cpm, &c, argv[1])) {
+    fprintf(stderr, "cannot open file: %s\n", argv[1]);
+    return 1;
+  }
+
+  m8080_trace t;
+  if(!m8080_trace_open(&t, &c, argv[2], compress)) {
+    fprintf(stderr, "cannot create trace: %s\n", argv[2]);
+    return 1;
+  }
+  size_t steps = 0;
+  double time = now();
+  while(!cpm.done) {
+    m8080_trace_step(&t, &c);
+    ++steps;
+  }
+  const bool written = m8080_trace_close(&t, &c);
+  time = now() - time;
+  m8080_cpm_free(&cpm);
+  if(!written) {
+    fprintf(stderr, "cannot write trace: %s\n", argv[2]);
+    return 1;
+  }
+
+  FILE* f = fopen(argv[2], "rb");
+  fseek(f, 0, SEEK_END);
+  const long size = ftell(f);
+  fclose(f);
+  printf("%zu instructions, %" PRIu64 " cycles in %.3fs (%.2f MHz)\n",
+      steps, c.cycles, time, c.cycles / time / 1e6);
+  printf("%ld bytes, %.2f bytes per instruction\n", size, (double)size / steps);
+
+  m8080_trace_reader r;
+  if(!m8080_trace_reader_open(&r, argv[2])) {
+    fprintf(stderr, "cannot read trace: %s\n", argv[2]);
+    return 1;
+  }
+
+  replay(&cpm, &c, argv[1]);
+  m8080_trace_record rec;
+  size_t read = 0;
+  time = now();
+  while(m8080_trace_next(&r, &rec)) {
+    step(&c);
+    if(!same(&rec, &c, true)) {
+      printf("mismatch at instruction %zu, pc 0x%04x\n", read, c.pc);
+      return 1;
+    }
+    ++read;
+  }
+  time = now() - time;
+  m8080_cpm_free(&cpm);
+  if(read != steps) {
+    printf("read %zu of %zu instructions\n", read, steps);
+    return 1;
+  }
+  printf("read back and replayed in %.3fs\n", time);
+
+  // seeking halfway must land on the same state as stepping there
+  const uint64_t middle = c.cycles / 2;
+  replay(&cpm, &c, argv[1]);
+  m8080 before;
+  do {
+    before = c;
+    step(&c);
+  } while(c.cycles <= middle);
+  time = now();
+  const bool found = m8080_trace_seek(&r, middle);
+  time = now() - time;
+  const bool landed = found && same(&r.last, &before, false)
+    && m8080_trace_next(&r, &rec) && same(&rec, &c, true);
+  m8080_cpm_free(&cpm);
+  m8080_trace_reader_close(&r);
+  if(!landed) {
+    printf("seek to cycle %" PRIu64 " went wrong\n", middle);
+    return 1;
+  }
+  printf("seek to cycle %" PRIu64 " in %.6fs\n", middle, time);
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.interrupts", argv[2]);
+  if(!interrupts(path)) {
+    printf("interrupts went wrong\n");
+    return 1;
+  }
+  return 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
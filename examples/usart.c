@@ -0,0 +1,230 @@
+/* Copyright (c) 2019 Pedro Minicz */
+// for the pseudo-terminal functions
+#define _GNU_SOURCE
+#define M8080_IMPLEMENTATION
+#include "m8080.h"
+#define M8080_PACE_IMPLEMENTATION
+#include "m8080_pace.h"
+#define M8080_USART_IMPLEMENTATION
+#include "m8080_usart.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// machines running an echo program on an 8251 serial port, either streaming
+// through the rings to two host threads as fast as possible:
+//
+//      $ ./usart 64 1000000
+//
+// or talking to a pseudo-terminal or a Unix socket in real time:
+//
+//      $ ./usart -p
+//      $ ./usart -s /tmp/m8080.sock
+
+// data at port 0x10, control at 0x11
+static const uint8_t program[] = {
+  0x3e, 0x4e,       // mvi a, 0x4e ; mode: 8 bits, no parity, 1 stop bit
+  0xd3, 0x11,       // out 0x11
+  0x3e, 0x37,       // mvi a, 0x37 ; command: transmit, receive, reset errors
+  0xd3, 0x11,       // out 0x11
+  0xdb, 0x11,       // loop: in 0x11
+  0xe6, 0x02,       // ani RXRDY
+  0xca, 0x08, 0x00, // jz loop
+  0xdb, 0x10,       // in 0x10
+  0x47,             // mov b, a
+  0xdb, 0x11,       // send: in 0x11
+  0xe6, 0x01,       // ani TXRDY
+  0xca, 0x12, 0x00, // jz send
+  0x78,             // mov a, b
+  0xd3, 0x10,       // out 0x10
+  0xc3, 0x08, 0x00, // jmp loop
+};
+
+#define RING 4096
+#define SLICE 100000
+#define CHUNK 1024
+
+typedef struct machine {
+  m8080 c;
+  m8080_usart u;
+  m8080_port ports[256];
+} machine;
+
+static machine* machines;
+static size_t count;
+static size_t bytes; // streamed through every machine
+static atomic_bool done;
+
+static uint8_t rb(const m8080* const c, const uint16_t a) {
+  return a < sizeof(program) ? program[a] : 0x00;
+}
+
+static void wb(m8080* const c, const uint16_t a, const uint8_t b) { }
+
+static const m8080_callbacks callbacks = { .rb = rb, .wb = wb };
+
+// the stream of machine I
+static inline uint8_t byte(const size_t i, const size_t n) {
+  return (uint8_t)(n * 31 + (n >> 8) + i);
+}
+
+static void* feed(void* const arg) {
+  size_t* const sent = calloc(count, sizeof(size_t));
+  size_t left = count;
+  while(left) {
+    bool moved = false;
+    for(size_t i = 0; i < count; ++i) {
+      uint8_t chunk[CHUNK];
+      size_t n = bytes - sent[i] < CHUNK ? bytes - sent[i] : CHUNK;
+      if(!n) continue;
+      for(size_t j = 0; j < n; ++j) chunk[j] = byte(i, sent[i] + j);
+      n = m8080_ring_write(&machines[i].u.rx, chunk, n);
+      sent[i] += n;
+      moved |= n > 0;
+      if(n && sent[i] == bytes) --left;
+    }
+    if(!moved) sched_yield();
+  }
+  free(sent);
+  return NULL;
+}
+
+static void* drain(void* const arg) {
+  size_t* const received = calloc(count, sizeof(size_t));
+  size_t left = count;
+  bool* const wrong = arg;
+  while(left) {
+    bool moved = false;
+    for(size_t i = 0; i < count; ++i) {
+      uint8_t chunk[CHUNK];
+      const size_t n = m8080_ring_read(&machines[i].u.tx, chunk, CHUNK);
+      for(size_t j = 0; j < n; ++j) *wrong |= chunk[j] != byte(i, received[i] + j);
+      received[i] += n;
+      moved |= n > 0;
+      if(n && received[i] == bytes) --left;
+    }
+    if(!moved) sched_yield();
+  }
+  free(received);
+  atomic_store(&done, true);
+  return NULL;
+}
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool start(machine* const m) {
+  memset(m, 0, sizeof(*m));
+  if(!m8080_usart_init(&m->u, RING)) return false;
+  m8080_usart_attach(&m->u, m->ports, 0x10, 0x11);
+  m->c.cb = &callbacks;
+  m->c.ports = m->ports;
+  // the polling loops only read the status port
+  m->c.fast_forward = true;
+  return true;
+}
+
+// one machine on a backend, at the original clock rate
+static int terminal(const char* const socket) {
+  static machine m;
+  char name[64];
+  if(!start(&m) || (socket ? !m8080_usart_listen(&m.u, socket)
+        : !m8080_usart_pty(&m.u, name, sizeof(name)))) {
+    fprintf(stderr, "cannot open the serial line\n");
+    return 1;
+  }
+  printf("connect to %s\n", socket ? socket : name);
+  fflush(stdout);
+  m8080_pace p;
+  m8080_pace_init(&p, &m.c, M8080_HZ);
+  while(m8080_usart_pump(&m.u)) {
+    m8080_run(&m.c, M8080_HZ / 1000);
+    m8080_pace_wait(&p, &m.c);
+  }
+  m8080_usart_free(&m.u);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if(argc > 1 && !strcmp(argv[1], "-p")) return terminal(NULL);
+  if(argc > 2 && !strcmp(argv[1], "-s")) return terminal(argv[2]);
+  if(argc > 3 || (argc > 1 && argv[1][0] == '-')) {
+    fprintf(stderr, "usage: %s [machines] [bytes]\n       %s -p\n       %s -s socket\n",
+        argv[0], argv[0], argv[0]);
+    return 1;
+  }
+  count = argc > 1 ? strtoul(argv[1], NULL, 0) : 64;
+  bytes = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+
+  machines = aligned_alloc(M8080_CACHE_LINE, count * sizeof(machine));
+  if(!machines) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  for(size_t i = 0; i < count; ++i) {
+    if(!start(&machines[i])) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+  }
+
+  bool wrong = false;
+  pthread_t feeder, drainer;
+  const double time = now();
+  pthread_create(&feeder, NULL, feed, NULL);
+  pthread_create(&drainer, NULL, drain, &wrong);
+  // the machines run on this thread, the host threads only touch the rings
+  while(!atomic_load(&done)) {
+    for(size_t i = 0; i < count; ++i) {
+      m8080_usart_update(&machines[i].u);
+      m8080_run(&machines[i].c, SLICE);
+    }
+  }
+  pthread_join(feeder, NULL);
+  pthread_join(drainer, NULL);
+  const double elapsed = now() - time;
+
+  printf("%zu machines echoed %zu bytes each in %.3fs (%.2f MB/s)\n",
+      count, bytes, elapsed, count * bytes / elapsed / 1e6);
+  for(size_t i = 0; i < count; ++i) m8080_usart_free(&machines[i].u);
+  free(machines);
+  if(wrong) {
+    printf("wrong echo\n");
+    return 1;
+  }
+  return 0;
+}
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
@@ -13,26 +13,86 @@
 #include <stddef.h>
 #include <stdint.h>
 
+struct m8080_callbacks;
+struct m8080_port;
+
+// condition bits, `c->f` holds them in the same format `push psw` saves them:
+//
+//      +---+---+---+---+---+---+---+---+
+//      | S | Z | 0 | A | 0 | P | 1 | C |
+//      +---+---+---+---+---+---+---+---+
+//
+// bit 1 always reads as 1 and bits 3 and 5 always as 0 but they are not
+// stored, so `c->f` only ever has the bits in M8080_FLAGS set
+#define M8080_FLAG_C 0x01 // carry
+#define M8080_FLAG_P 0x04 // parity bit
+#define M8080_FLAG_A 0x10 // auxiliary carry
+#define M8080_FLAG_Z 0x40 // zero bit
+#define M8080_FLAG_S 0x80 // sign bit
+#define M8080_FLAGS  0xd5
+
+// 1 if FLAG (C, P, A, Z or S) is set and 0 otherwise
+#define M8080_GET_FLAG(c, flag) (((c)->f & M8080_FLAG_##flag) != 0)
+// sets FLAG (C, P, A, Z or S) if V is true and resets it otherwise
+#define M8080_SET_FLAG(c, flag, v) \
+  ((c)->f = (v) ? (c)->f | M8080_FLAG_##flag : (c)->f & ~M8080_FLAG_##flag)
+
+// every instance takes exactly one cache line, hot state (the fields
+// `m8080_step` touches on almost every instruction) first, so that machines in
+// an array run by different threads never share a line
+#define M8080_CACHE_LINE 64
+
 typedef struct m8080 {
-  struct {
-    uint8_t c; // carry
-    uint8_t p; // parity bit
-    uint8_t a; // auxiliary carry
-    uint8_t z; // zero bit
-    uint8_t s; // sign bit
-  } f;
-  uint8_t a; // accumulator
+  // hot state
+  //
+  // cycles executed since reset, only ever increases, 64 bits so that it
+  // doesn't wrap around on 32-bit hosts
+  _Alignas(M8080_CACHE_LINE) uint64_t cycles;
+  uint16_t pc; // program counter
+  uint16_t sp; // stack pointer
+  // the accumulator and the flags double as the 16-bit program status word
+  union { struct { uint8_t f, a; }; uint16_t psw; };
   // 6 8-bit registers that double as 3 16-bit registers
+  union { struct { uint8_t l, h; }; uint16_t hl; };
   union { struct { uint8_t c, b; }; uint16_t bc; };
   union { struct { uint8_t e, d; }; uint16_t de; };
-  union { struct { uint8_t l, h; }; uint16_t hl; };
-  uint16_t sp; // stack pointer
-  uint16_t pc; // program counter
+  // `m8080_run` tests them all at once after every instruction
+  union {
+    struct {
+      uint8_t halted; // set by hlt until the next interrupt
+      // set when a pending interrupt can be taken, 2 right after ei
+      uint8_t ready;
+      // set by `m8080_suspend` until `m8080_resume`
+      uint8_t suspended;
+      uint8_t reserved; // always 0
+    };
+    uint32_t attention;
+  };
+
+  // cold state, only read by `m8080_run` and when calling out
+  //
   uint8_t inte; // interrupt enable
-  size_t cycles;
+  uint8_t irq; // pending interrupt requests, see `m8080_irq`
+  // set if reading memory has no side effects and memory is only written by
+  // this CPU while `m8080_run` executes, allows `m8080_run` to skip idle loops
+  // and to read the opcode after a superinstruction's first one ahead of time
+  uint8_t fast_forward;
+  // end of the current `m8080_run` slice
+  uint64_t deadline;
   void* userdata;
+  // memory and device callbacks, see `m8080_callbacks`
+  const struct m8080_callbacks* cb;
+  // optional table of 256 I/O ports, if null every in and out instruction
+  // goes to the `in` and `out` callbacks
+  struct m8080_port* ports;
 } m8080;
 
+// the hot state must fit in the first 24 bytes and the whole structure in one
+// cache line, arrays of `m8080` allocated with `malloc` should use
+// `aligned_alloc(M8080_CACHE_LINE, ...)` instead
+_Static_assert(sizeof(m8080) == M8080_CACHE_LINE, "m8080 must fill one cache line");
+_Static_assert(offsetof(m8080, attention) + sizeof(uint32_t) <= 24, "m8080 hot state must come first");
+
 // restart instruction subroutine call addresses
 enum {
   M8080_RST_0 = 0x0000, M8080_RST_1 = 0x0008,
@@ -45,8 +105,94 @@ enum {
 // set `b` if there is a breakpoint at `pos`
 // doesn't print an end of line
 int m8080_disassemble(const m8080* const c, const uint16_t pos, const bool b);
+// size in bytes of the instruction starting with OPCODE
+int m8080_instruction_size(const uint8_t opcode);
+// cycles the instruction starting with OPCODE takes, conditional calls and
+// returns take 6 more when taken
+int m8080_instruction_cycles(const uint8_t opcode);
+
+// the undocumented nop opcodes (0x08, 0x10, ..., 0x38) are traps when
+// `c->cb->trap` is set, environments emulated outside of the CPU (such as an
+// operating system) place them at their entry points and get called when the
+// program gets there, `c->pc` points after the trap
+//
+// a trap costs no cycles by itself, the handler adds the cost of whatever it
+// does to `c->cycles`
+static inline bool m8080_is_trap(const uint8_t opcode) {
+  return (opcode & 0xc7) == 0 && opcode != 0x00;
+}
 
 size_t m8080_step(m8080* const c);
+// sets `c->deadline` and steps until `c->cycles` reaches it, returns the number
+// of cycles executed
+//
+// a halted CPU only wakes up on an interrupt, so the remaining cycles are
+// skipped at once, if `fast_forward` is set, small loops that only read memory
+// or ports without an `in` handler and come back to the exact same state every
+// iteration (e.g. polling a flag set by an interrupt handler) are skipped as
+// well, the result is the same as stepping through them
+uint64_t m8080_run_until(m8080* const c, const uint64_t deadline);
+// runs a slice of `cycles` cycles starting where the previous slice was
+// supposed to end rather than where it actually ended, so the last
+// instruction of a slice overshooting the deadline is made up for in the next
+// slice and the long-term rate is exact:
+//
+//      m8080_run(c, 2000000 / 60); // one frame at 60 Hz
+//
+// if `c->cycles` already went past the next deadline (e.g. by stepping), the
+// slice starts at `c->cycles` instead
+uint64_t m8080_run(m8080* const c, const uint64_t cycles);
+// the deadline `m8080_run` would give the next slice of `cycles` cycles
+static inline uint64_t m8080_next_deadline(const m8080* const c, const uint64_t cycles) {
+  const uint64_t deadline = c->deadline + cycles;
+  return deadline < c->cycles ? c->cycles + cycles : deadline;
+}
+
+// for tools that look at every instruction (see `m8080_heat.h` and
+// `m8080_profile.h`), runs a slice one instruction at a time through
+// `m8080_run_until`, so pending interrupts are taken as usual but polling
+// loops are not skipped, which makes a watched machine several times slower:
+//
+//      m8080_watch w;
+//      int event;
+//      while((event = m8080_watch_next(c, deadline, &w)) != M8080_WATCH_END) {
+//        look(c, &w, event);
+//      }
+//
+// `w` is the state before the event, the opcode of an instruction is read
+// through `m8080_rb` before it runs so callbacks counting reads see it once
+// more, an in or out that suspends the CPU ends the slice without running
+enum {
+  M8080_WATCH_END, // the slice is over, nothing ran
+  M8080_WATCH_INSTRUCTION,
+  M8080_WATCH_INTERRUPT, // a pending interrupt was taken
+  M8080_WATCH_HALTED, // halted until an interrupt, the rest of the slice passed
+  M8080_WATCH_SUSPENDED, // the instruction suspended the CPU, it didn't run
+};
+
+typedef struct m8080_watch {
+  uint64_t cycles;
+  uint16_t pc;
+  uint16_t sp;
+  uint8_t opcode; // of the instruction, 0x00 for an interrupt
+} m8080_watch;
+
+// runs the next event of the slice ending at `deadline`, sets `c->deadline`
+int m8080_watch_next(m8080* const c, const uint64_t deadline, m8080_watch* const w);
+
+// clock rate of the original 8080 in Hz
+#define M8080_HZ 2000000
+
+// converts between cycles at a clock rate of `hz` and nanoseconds without
+// overflowing for any realistic run time
+static inline uint64_t m8080_cycles_to_ns(const uint64_t cycles, const uint64_t hz) {
+  return cycles / hz * 1000000000 + cycles % hz * 1000000000 / hz;
+}
+
+static inline uint64_t m8080_ns_to_cycles(const uint64_t ns, const uint64_t hz) {
+  return ns / 1000000000 * hz + ns % 1000000000 * hz / 1000000000;
+}
+
 // when the original 8080 recognizes an interrupt request from an external
 // device, the following actions occur:
 //
@@ -60,15 +206,98 @@ size_t m8080_step(m8080* const c);
 // subroutines located in the first 64 bytes of memory
 //
 // this emulator supply interrupts as a "call if interrupt enable" to an
-// arbitrary address A, the interrupt enable bit is reset as expected
+// arbitrary address A, the interrupt enable bit is reset as expected and a
+// halted CPU resumes after the hlt instruction
 size_t m8080_interrupt(m8080* const c, const uint16_t a);
 
-// the user is expected to implement the following five functions
+// `m8080_interrupt` is taken right away or not at all, hosts that don't want
+// to poll instead raise one of 8 interrupt request lines, which stays pending
+// until the CPU acknowledges it:
+//
+//      m8080_irq(c, 1); // the screen is half drawn
+//      m8080_run(c, M8080_HZ / 120);
+//
+// `m8080_run` takes the highest pending line as soon as interrupts are
+// enabled, after the instruction that follows ei like the original 8080, the
+// device supplies rst N for line N unless `c->cb->inta` says otherwise
+//
+// the lines are only looked at when they or the interrupt enable bit change,
+// raising one from a callback is taken after the current instruction, stepping
+// with `m8080_step` alone never takes them
+static inline void m8080_irq(m8080* const c, const uint8_t line) {
+  c->irq |= 1 << (line & 7);
+  if(c->inte && !c->ready) c->ready = 1;
+}
+
+// withdraws a request that wasn't acknowledged yet
+static inline void m8080_irq_clear(m8080* const c, const uint8_t line) {
+  c->irq &= ~(1 << (line & 7));
+  if(!c->irq) c->ready = 0;
+}
 
-// read byte
+// the emulator accesses memory and devices through five callbacks, by default
+// they are stored per instance in `c->cb` so that different kinds of machines
+// can live in the same program:
+//
+//      static const m8080_callbacks callbacks = {
+//        .rb = my_rb, .wb = my_wb, .in = my_in, .out = my_out, .hlt = my_hlt,
+//      };
+//      c->cb = &callbacks;
+//
+// `rb` and `wb` are required, the others may be null, if M8080_EXTERN_CALLBACKS
+// is defined (in every file that includes this header) `c->cb` is ignored and
+// the user must instead implement the functions `m8080_rb`, `m8080_wb`,
+// `m8080_in`, `m8080_out` and `m8080_hlt`, which lets the compiler inline
+// them into `m8080_step`
+typedef struct m8080_callbacks {
+  // read byte
+  uint8_t (*rb)(const m8080* const c, const uint16_t a);
+  // write byte
+  void (*wb)(m8080* const c, const uint16_t a, const uint8_t b);
+  // the contents of input device A are read into the accumulator
+  void (*in)(m8080* const c, const uint8_t a);
+  // the contents of the accumulator are sent to output device A
+  void (*out)(m8080* const c, const uint8_t a);
+  // halt instruction, called when the CPU executes hlt, the CPU then stays
+  // halted (`c->halted`) until an interrupt without the user doing anything
+  void (*hlt)(m8080* const c);
+  // the next two are rare, so they are always called through `c->cb` (if it
+  // isn't null), even with M8080_EXTERN_CALLBACKS
+  //
+  // optional trap handler, see `m8080_is_trap`
+  void (*trap)(m8080* const c, const uint8_t opcode);
+  // optional interrupt acknowledge, returns the address the device calls for
+  // `line`, addresses other than the rst ones cost a whole call instruction
+  uint16_t (*inta)(m8080* const c, const uint8_t line);
+} m8080_callbacks;
+
+#ifdef M8080_EXTERN_CALLBACKS
 uint8_t m8080_rb(const m8080* const c, const uint16_t a);
-// write byte
 void m8080_wb(m8080* const c, const uint16_t a, const uint8_t b);
+void m8080_in(m8080* const c, const uint8_t a);
+void m8080_out(m8080* const c, const uint8_t a);
+void m8080_hlt(m8080* const c);
+#else
+static inline uint8_t m8080_rb(const m8080* const c, const uint16_t a) {
+  return c->cb->rb(c, a);
+}
+
+static inline void m8080_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  c->cb->wb(c, a, b);
+}
+
+static inline void m8080_in(m8080* const c, const uint8_t a) {
+  if(c->cb->in) c->cb->in(c, a);
+}
+
+static inline void m8080_out(m8080* const c, const uint8_t a) {
+  if(c->cb->out) c->cb->out(c, a);
+}
+
+static inline void m8080_hlt(m8080* const c) {
+  if(c->cb->hlt) c->cb->hlt(c);
+}
+#endif
 
 // read word
 static inline uint16_t m8080_rw(const m8080* const c, const uint16_t a) {
@@ -82,12 +311,228 @@ static inline uint16_t m8080_ww(m8080* const c, const uint16_t a, const uint16_t
   return m8080_rw(c, a);
 }
 
-// the contents of input device A are read into the accumulator
-void m8080_in(m8080* const c, const uint8_t a);
-// the contents of the accumulator are sent to output device A
-void m8080_out(m8080* const c, const uint8_t a);
-// halt instruction
-void m8080_hlt(m8080* const c);
+// entry of a port table (`c->ports`), devices in separate modules can each
+// register the ports they use instead of sharing one `in`/`out` callback:
+//
+//      static m8080_port ports[256];
+//      ports[3].in = shift_in;
+//      ports[3].ctx = &shifter;
+//      ports[1].value = 0x08; // constant, read inline without a call
+//      c->ports = ports;
+//
+// ports without an `in` handler read `value` and ports without an `out`
+// handler store the accumulator in `latch`, both without leaving `m8080_step`,
+// so a zeroed table reads zero everywhere and ignores writes
+typedef struct m8080_port {
+  // returns the byte read from port A
+  uint8_t (*in)(m8080* const c, void* const ctx, const uint8_t a);
+  // receives the byte B written to port A
+  void (*out)(m8080* const c, void* const ctx, const uint8_t a, const uint8_t b);
+  void* ctx;
+  uint8_t value; // read if `in` is null
+  uint8_t latch; // last write if `out` is null
+} m8080_port;
+
+// devices backed by slow host I/O (files, pipes, sockets) don't have to block
+// in their `in` or `out` handler, instead they suspend the CPU in the middle
+// of the instruction and `m8080_run` returns right away, the host then waits
+// for the device however it likes (e.g. `epoll`) and resumes the CPU with the
+// byte the instruction reads:
+//
+//      static void my_in(m8080* const c, const uint8_t a) {
+//        uint8_t b;
+//        if(read(fd, &b, 1) == 1) c->a = b;
+//        else m8080_suspend(c); // and wait until `fd` is readable
+//      }
+//
+//      // later, in the event loop
+//      read(fd, &b, 1);
+//      m8080_resume(c, b);
+//      m8080_run(c, M8080_HZ / 60);
+//
+// the suspended instruction hasn't executed at all, the program counter points
+// at it and no cycles were counted, `m8080_resume` finishes it (in reads B,
+// out ignores it) and interrupts are only taken afterwards, a suspended CPU
+// doesn't run and `m8080_run` returns at once, so one thread can multiplex any
+// number of machines waiting on their devices
+//
+// only call `m8080_suspend` from an `in` or `out` handler (callback or port
+// table), the batch engine (see `m8080_batch.h`) doesn't support it
+void m8080_suspend(m8080* const c);
+void m8080_resume(m8080* const c, const uint8_t b);
+
+// optional paged memory that the `rb` and `wb` callbacks can be implemented on
+// top of, the address space is split into pages that are shared between forks
+// of the same machine and only copied when written (copy-on-write):
+//
+//      uint8_t my_rb(const m8080* const c, const uint16_t a) {
+//        return m8080_memory_rb(c->userdata, a);
+//      }
+//
+//      void my_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+//        m8080_memory_wb(c->userdata, a, b);
+//      }
+//
+// `m8080_memory_callbacks` does exactly that for machines whose `userdata` is
+// the `m8080_memory` and have no devices
+//
+// a machine is forked by copying the `m8080` structure and calling
+// `m8080_memory_fork` on its memory, so a child costs one table copy instead
+// of 64 KiB
+//
+// memory beyond 64 KiB is bank-switched by mapping host memory over a window
+// of pages, a device selecting a bank from its `out` handler swaps one pointer
+// per page and every access after that goes straight to the bank:
+//
+//      static uint8_t banks[8][0x4000];
+//      m8080_memory_map(m, 0x4000, 0x4000, banks[c->a & 7], false);
+#define M8080_PAGE_BITS 12
+#define M8080_PAGE_SIZE (1 << M8080_PAGE_BITS)
+#define M8080_PAGE_MASK (M8080_PAGE_SIZE - 1)
+#define M8080_PAGES (0x10000 >> M8080_PAGE_BITS)
+
+typedef struct m8080_page m8080_page;
+
+typedef struct m8080_memory {
+  // `read` always points to the page data, `write` is null if the page is
+  // shared with another fork or read-only
+  uint8_t* read[M8080_PAGES];
+  uint8_t* write[M8080_PAGES];
+  m8080_page* page[M8080_PAGES];
+  // bit N set means writes to page N are ignored (ROM), see
+  // `m8080_memory_protect`
+  uint32_t rom;
+  // host memory mapped over page N by `m8080_memory_map`, null while the page
+  // is the machine's own, a bank mapped read-only has no `write` pointer
+  uint8_t* bank[M8080_PAGES];
+} m8080_memory;
+
+// allocates zeroed memory, returns false if out of memory
+bool m8080_memory_init(m8080_memory* const m);
+void m8080_memory_free(m8080_memory* const m);
+// makes `dst` share every page of `src`, neither is copied until written
+// `src` is modified since its pages are no longer exclusively owned
+//
+// pages may be shared between threads, but a single `m8080_memory` must only
+// be used by one thread at a time
+void m8080_memory_fork(m8080_memory* const dst, m8080_memory* const src);
+// copies `size` bytes from `data` to address A ignoring read-only pages
+bool m8080_memory_load(m8080_memory* const m, const uint16_t a,
+    const void* const data, const size_t size);
+// makes the pages overlapping `size` bytes from address A read-only
+void m8080_memory_protect(m8080_memory* const m, const uint16_t a, const size_t size);
+// maps `size` bytes of DATA over the address space from A until
+// `m8080_memory_unmap` gives the pages back, A and SIZE must be multiples of
+// M8080_PAGE_SIZE, writes to a bank mapped with ROM set are ignored
+//
+// banks belong to the user and are not copied by `m8080_memory_fork`, forks
+// of a machine share them like a device shared by two CPUs, and translated
+// code covering the window has to be dropped with `m8080_rom_invalidate`
+void m8080_memory_map(m8080_memory* const m, const uint16_t a, const size_t size,
+    void* const data, const bool rom);
+void m8080_memory_unmap(m8080_memory* const m, const uint16_t a, const size_t size);
+// called by `m8080_memory_wb` when writing to a shared or read-only page
+void m8080_memory_fault(m8080_memory* const m, const uint16_t a, const uint8_t b);
+
+static inline uint8_t m8080_memory_rb(const m8080_memory* const m, const uint16_t a) {
+  return m->read[a >> M8080_PAGE_BITS][a & M8080_PAGE_MASK];
+}
+
+static inline void m8080_memory_wb(m8080_memory* const m, const uint16_t a, const uint8_t b) {
+  uint8_t* const page = m->write[a >> M8080_PAGE_BITS];
+  if(page) page[a & M8080_PAGE_MASK] = b;
+  else m8080_memory_fault(m, a, b);
+}
+
+extern const m8080_callbacks m8080_memory_callbacks;
+
+// ROM that is translated ahead of time, when it is loaded, instead of being
+// fetched and decoded on every instruction, every instruction reachable from
+// the given entry points (following jumps, calls and rst) is decoded once into
+// an entry per address:
+//
+//      m8080_rom rom;
+//      m8080_rom_init(&rom, c, 0x0000, 0x2000);
+//      if(!m8080_rom_load(&rom, "invaders.code")) {
+//        for(uint16_t a = M8080_RST_0; a <= M8080_RST_7; a += 8) m8080_rom_translate(&rom, c, a);
+//        m8080_rom_save(&rom, "invaders.code");
+//      }
+//      m8080_rom_run(c, &rom, M8080_HZ / 60);
+//
+// code only reached through pchl or a return address pushed by hand is
+// translated by `m8080_rom_run` the first time it gets there, addresses
+// outside the ROM run as usual
+//
+// a saved translation is only loaded for the same ROM contents, translation
+// version and byte order, it is mapped read-only (on POSIX hosts) so that many
+// processes starting the same ROM share it, and every block of
+// M8080_ROM_BLOCK addresses is copied out of it and checked against memory the
+// first time code in the block runs, so loading costs nothing up front
+//
+// the translation is never checked against memory again, so the `wb` callback
+// must ignore writes to the ROM, except for the bytes passed to
+// `m8080_rom_forget`
+
+// bumped whenever a saved translation would mean something else
+#define M8080_ROM_VERSION 1
+#define M8080_ROM_BLOCK 256
+
+typedef struct m8080_code {
+  uint8_t opcode;
+  uint8_t size; // 0 if this address wasn't translated
+  uint16_t operand; // the following byte or word
+} m8080_code;
+
+typedef struct m8080_rom {
+  uint16_t base;
+  size_t size;
+  // one entry per address from `base`
+  m8080_code* code;
+  // set for bytes that are written and so never translated
+  uint8_t* skip;
+  // set where the run loop found nothing to translate (it runs into a
+  // skipped byte or the end of the ROM) so it doesn't try again, not saved
+  uint8_t* failed;
+  // addresses waiting to be translated
+  uint16_t* queue;
+  // of the ROM contents, ties a saved translation to the ROM it came from
+  uint64_t hash;
+  // loaded translation, null if none, and which of its blocks were already
+  // checked and copied to `code`
+  const m8080_code* saved;
+  uint8_t* taken;
+  // blocks that may have translated entries, so that invalidating a window
+  // with little code in it is cheap
+  uint8_t* filled;
+  void* map;
+  size_t map_size;
+} m8080_rom;
+
+// covers `size` bytes of memory from `base`, which must already hold the
+// ROM, returns false if out of memory
+bool m8080_rom_init(m8080_rom* const r, const m8080* const c, const uint16_t base, const size_t size);
+void m8080_rom_free(m8080_rom* const r);
+// translates every instruction reachable from address A, returns the number
+// of instructions newly translated
+size_t m8080_rom_translate(m8080_rom* const r, const m8080* const c, const uint16_t a);
+// drops the translation of every instruction covering address A and never
+// translates them again, for the few bytes of a ROM image that turn out to be
+// written (e.g. patched code)
+void m8080_rom_forget(m8080_rom* const r, const uint16_t a);
+// drops the translation of every instruction overlapping `size` bytes from
+// address A, which is translated again the next time it runs (even where it
+// failed before), for windows where another bank was mapped (see
+// `m8080_memory_map`), only the blocks of M8080_ROM_BLOCK addresses holding
+// translated code are cleared
+void m8080_rom_invalidate(m8080_rom* const r, const uint16_t a, const size_t size);
+// the translation can be kept on disk, loading fails if the file doesn't
+// exist or was saved for a different ROM or version, saving replaces the file
+// at once so that processes still using the old one are not disturbed
+bool m8080_rom_save(const m8080_rom* const r, const char* const path);
+bool m8080_rom_load(m8080_rom* const r, const char* const path);
+// `m8080_run_until` and `m8080_run` running translated instructions from `r`
+uint64_t m8080_rom_run_until(m8080* const c, m8080_rom* const r, const uint64_t deadline);
+uint64_t m8080_rom_run(m8080* const c, m8080_rom* const r, const uint64_t cycles);
 
 #endif // M8080_H
 
@@ -97,6 +542,21 @@ void m8080_hlt(m8080* const c);
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// `m8080_execute` and the run loop are copied into each of their callers even
+// though they are big, so that the arguments choosing where operands come from
+// and whether to fuse are constants in every copy
+#ifdef __GNUC__
+#define M8080_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define M8080_ALWAYS_INLINE inline
+#endif
+
+#ifndef __STDC_NO_ATOMICS__
+#include <stdatomic.h>
+#endif
 
 static const size_t m8080_cycles[] = {
   4, 10,7, 5, 5, 5, 7, 4, 4, 10,7, 5, 5, 5, 7, 4, // 00..0f
@@ -117,18 +577,210 @@ static const size_t m8080_cycles[] = {
   5, 10,10,4, 11,11,7, 11,5, 5, 10,4, 11,17,7,11, // f0..ff
 };
 
-// 1 for even parity and 0 for odd parity
-static const uint8_t m8080_parity[] = {
-  1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0, // 00..1f
-  0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1, // 20..3f
-  0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1, // 40..5f
-  1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0, // 60..7f
-  0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1, // 80..9f
-  1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0, // a0..bf
-  1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0, // c0..df
-  0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1, // e0..ff
+// sign, zero and parity flags of every byte, in their `push psw` positions
+static const uint8_t m8080_szp[] = {
+  0x44,0x00,0x00,0x04,0x00,0x04,0x04,0x00,0x00,0x04,0x04,0x00,0x04,0x00,0x00,0x04, // 00..0f
+  0x00,0x04,0x04,0x00,0x04,0x00,0x00,0x04,0x04,0x00,0x00,0x04,0x00,0x04,0x04,0x00, // 10..1f
+  0x00,0x04,0x04,0x00,0x04,0x00,0x00,0x04,0x04,0x00,0x00,0x04,0x00,0x04,0x04,0x00, // 20..2f
+  0x04,0x00,0x00,0x04,0x00,0x04,0x04,0x00,0x00,0x04,0x04,0x00,0x04,0x00,0x00,0x04, // 30..3f
+  0x00,0x04,0x04,0x00,0x04,0x00,0x00,0x04,0x04,0x00,0x00,0x04,0x00,0x04,0x04,0x00, // 40..4f
+  0x04,0x00,0x00,0x04,0x00,0x04,0x04,0x00,0x00,0x04,0x04,0x00,0x04,0x00,0x00,0x04, // 50..5f
+  0x04,0x00,0x00,0x04,0x00,0x04,0x04,0x00,0x00,0x04,0x04,0x00,0x04,0x00,0x00,0x04, // 60..6f
+  0x00,0x04,0x04,0x00,0x04,0x00,0x00,0x04,0x04,0x00,0x00,0x04,0x00,0x04,0x04,0x00, // 70..7f
+  0x80,0x84,0x84,0x80,0x84,0x80,0x80,0x84,0x84,0x80,0x80,0x84,0x80,0x84,0x84,0x80, // 80..8f
+  0x84,0x80,0x80,0x84,0x80,0x84,0x84,0x80,0x80,0x84,0x84,0x80,0x84,0x80,0x80,0x84, // 90..9f
+  0x84,0x80,0x80,0x84,0x80,0x84,0x84,0x80,0x80,0x84,0x84,0x80,0x84,0x80,0x80,0x84, // a0..af
+  0x80,0x84,0x84,0x80,0x84,0x80,0x80,0x84,0x84,0x80,0x80,0x84,0x80,0x84,0x84,0x80, // b0..bf
+  0x84,0x80,0x80,0x84,0x80,0x84,0x84,0x80,0x80,0x84,0x84,0x80,0x84,0x80,0x80,0x84, // c0..cf
+  0x80,0x84,0x84,0x80,0x84,0x80,0x80,0x84,0x84,0x80,0x80,0x84,0x80,0x84,0x84,0x80, // d0..df
+  0x80,0x84,0x84,0x80,0x84,0x80,0x80,0x84,0x84,0x80,0x80,0x84,0x80,0x84,0x84,0x80, // e0..ef
+  0x84,0x80,0x80,0x84,0x80,0x84,0x84,0x80,0x80,0x84,0x84,0x80,0x84,0x80,0x80,0x84, // f0..ff
 };
 
+// result of daa (low byte) and the flags it sets (high byte, `push psw`
+// positions) indexed by the accumulator, carry (bit 8) and auxiliary carry
+// (bit 9)
+static const uint16_t m8080_daa_table[] = {
+  0x4400, 0x0001, 0x0002, 0x0403, 0x0004, 0x0405, 0x0406, 0x0007, // 000..007
+  0x0008, 0x0409, 0x1010, 0x1411, 0x1412, 0x1013, 0x1414, 0x1015, // 008..00f
+  0x0010, 0x0411, 0x0412, 0x0013, 0x0414, 0x0015, 0x0016, 0x0417, // 010..017
+  0x0418, 0x0019, 0x1020, 0x1421, 0x1422, 0x1023, 0x1424, 0x1025, // 018..01f
+  0x0020, 0x0421, 0x0422, 0x0023, 0x0424, 0x0025, 0x0026, 0x0427, // 020..027
+  0x0428, 0x0029, 0x1430, 0x1031, 0x1032, 0x1433, 0x1034, 0x1435, // 028..02f
+  0x0430, 0x0031, 0x0032, 0x0433, 0x0034, 0x0435, 0x0436, 0x0037, // 030..037
+  0x0038, 0x0439, 0x1040, 0x1441, 0x1442, 0x1043, 0x1444, 0x1045, // 038..03f
+  0x0040, 0x0441, 0x0442, 0x0043, 0x0444, 0x0045, 0x0046, 0x0447, // 040..047
+  0x0448, 0x0049, 0x1450, 0x1051, 0x1052, 0x1453, 0x1054, 0x1455, // 048..04f
+  0x0450, 0x0051, 0x0052, 0x0453, 0x0054, 0x0455, 0x0456, 0x0057, // 050..057
+  0x0058, 0x0459, 0x1460, 0x1061, 0x1062, 0x1463, 0x1064, 0x1465, // 058..05f
+  0x0460, 0x0061, 0x0062, 0x0463, 0x0064, 0x0465, 0x0466, 0x0067, // 060..067
+  0x0068, 0x0469, 0x1070, 0x1471, 0x1472, 0x1073, 0x1474, 0x1075, // 068..06f
+  0x0070, 0x0471, 0x0472, 0x0073, 0x0474, 0x0075, 0x0076, 0x0477, // 070..077
+  0x0478, 0x0079, 0x9080, 0x9481, 0x9482, 0x9083, 0x9484, 0x9085, // 078..07f
+  0x8080, 0x8481, 0x8482, 0x8083, 0x8484, 0x8085, 0x8086, 0x8487, // 080..087
+  0x8488, 0x8089, 0x9490, 0x9091, 0x9092, 0x9493, 0x9094, 0x9495, // 088..08f
+  0x8490, 0x8091, 0x8092, 0x8493, 0x8094, 0x8495, 0x8496, 0x8097, // 090..097
+  0x8098, 0x8499, 0x5500, 0x1101, 0x1102, 0x1503, 0x1104, 0x1505, // 098..09f
+  0x4500, 0x0101, 0x0102, 0x0503, 0x0104, 0x0505, 0x0506, 0x0107, // 0a0..0a7
+  0x0108, 0x0509, 0x1110, 0x1511, 0x1512, 0x1113, 0x1514, 0x1115, // 0a8..0af
+  0x0110, 0x0511, 0x0512, 0x0113, 0x0514, 0x0115, 0x0116, 0x0517, // 0b0..0b7
+  0x0518, 0x0119, 0x1120, 0x1521, 0x1522, 0x1123, 0x1524, 0x1125, // 0b8..0bf
+  0x0120, 0x0521, 0x0522, 0x0123, 0x0524, 0x0125, 0x0126, 0x0527, // 0c0..0c7
+  0x0528, 0x0129, 0x1530, 0x1131, 0x1132, 0x1533, 0x1134, 0x1535, // 0c8..0cf
+  0x0530, 0x0131, 0x0132, 0x0533, 0x0134, 0x0535, 0x0536, 0x0137, // 0d0..0d7
+  0x0138, 0x0539, 0x1140, 0x1541, 0x1542, 0x1143, 0x1544, 0x1145, // 0d8..0df
+  0x0140, 0x0541, 0x0542, 0x0143, 0x0544, 0x0145, 0x0146, 0x0547, // 0e0..0e7
+  0x0548, 0x0149, 0x1550, 0x1151, 0x1152, 0x1553, 0x1154, 0x1555, // 0e8..0ef
+  0x0550, 0x0151, 0x0152, 0x0553, 0x0154, 0x0555, 0x0556, 0x0157, // 0f0..0f7
+  0x0158, 0x0559, 0x1560, 0x1161, 0x1162, 0x1563, 0x1164, 0x1565, // 0f8..0ff
+  0x0560, 0x0161, 0x0162, 0x0563, 0x0164, 0x0565, 0x0566, 0x0167, // 100..107
+  0x0168, 0x0569, 0x1170, 0x1571, 0x1572, 0x1173, 0x1574, 0x1175, // 108..10f
+  0x0170, 0x0571, 0x0572, 0x0173, 0x0574, 0x0175, 0x0176, 0x0577, // 110..117
+  0x0578, 0x0179, 0x9180, 0x9581, 0x9582, 0x9183, 0x9584, 0x9185, // 118..11f
+  0x8180, 0x8581, 0x8582, 0x8183, 0x8584, 0x8185, 0x8186, 0x8587, // 120..127
+  0x8588, 0x8189, 0x9590, 0x9191, 0x9192, 0x9593, 0x9194, 0x9595, // 128..12f
+  0x8590, 0x8191, 0x8192, 0x8593, 0x8194, 0x8595, 0x8596, 0x8197, // 130..137
+  0x8198, 0x8599, 0x95a0, 0x91a1, 0x91a2, 0x95a3, 0x91a4, 0x95a5, // 138..13f
+  0x85a0, 0x81a1, 0x81a2, 0x85a3, 0x81a4, 0x85a5, 0x85a6, 0x81a7, // 140..147
+  0x81a8, 0x85a9, 0x91b0, 0x95b1, 0x95b2, 0x91b3, 0x95b4, 0x91b5, // 148..14f
+  0x81b0, 0x85b1, 0x85b2, 0x81b3, 0x85b4, 0x81b5, 0x81b6, 0x85b7, // 150..157
+  0x85b8, 0x81b9, 0x95c0, 0x91c1, 0x91c2, 0x95c3, 0x91c4, 0x95c5, // 158..15f
+  0x85c0, 0x81c1, 0x81c2, 0x85c3, 0x81c4, 0x85c5, 0x85c6, 0x81c7, // 160..167
+  0x81c8, 0x85c9, 0x91d0, 0x95d1, 0x95d2, 0x91d3, 0x95d4, 0x91d5, // 168..16f
+  0x81d0, 0x85d1, 0x85d2, 0x81d3, 0x85d4, 0x81d5, 0x81d6, 0x85d7, // 170..177
+  0x85d8, 0x81d9, 0x91e0, 0x95e1, 0x95e2, 0x91e3, 0x95e4, 0x91e5, // 178..17f
+  0x81e0, 0x85e1, 0x85e2, 0x81e3, 0x85e4, 0x81e5, 0x81e6, 0x85e7, // 180..187
+  0x85e8, 0x81e9, 0x95f0, 0x91f1, 0x91f2, 0x95f3, 0x91f4, 0x95f5, // 188..18f
+  0x85f0, 0x81f1, 0x81f2, 0x85f3, 0x81f4, 0x85f5, 0x85f6, 0x81f7, // 190..197
+  0x81f8, 0x85f9, 0x5500, 0x1101, 0x1102, 0x1503, 0x1104, 0x1505, // 198..19f
+  0x4500, 0x0101, 0x0102, 0x0503, 0x0104, 0x0505, 0x0506, 0x0107, // 1a0..1a7
+  0x0108, 0x0509, 0x1110, 0x1511, 0x1512, 0x1113, 0x1514, 0x1115, // 1a8..1af
+  0x0110, 0x0511, 0x0512, 0x0113, 0x0514, 0x0115, 0x0116, 0x0517, // 1b0..1b7
+  0x0518, 0x0119, 0x1120, 0x1521, 0x1522, 0x1123, 0x1524, 0x1125, // 1b8..1bf
+  0x0120, 0x0521, 0x0522, 0x0123, 0x0524, 0x0125, 0x0126, 0x0527, // 1c0..1c7
+  0x0528, 0x0129, 0x1530, 0x1131, 0x1132, 0x1533, 0x1134, 0x1535, // 1c8..1cf
+  0x0530, 0x0131, 0x0132, 0x0533, 0x0134, 0x0535, 0x0536, 0x0137, // 1d0..1d7
+  0x0138, 0x0539, 0x1140, 0x1541, 0x1542, 0x1143, 0x1544, 0x1145, // 1d8..1df
+  0x0140, 0x0541, 0x0542, 0x0143, 0x0544, 0x0145, 0x0146, 0x0547, // 1e0..1e7
+  0x0548, 0x0149, 0x1550, 0x1151, 0x1152, 0x1553, 0x1154, 0x1555, // 1e8..1ef
+  0x0550, 0x0151, 0x0152, 0x0553, 0x0154, 0x0555, 0x0556, 0x0157, // 1f0..1f7
+  0x0158, 0x0559, 0x1560, 0x1161, 0x1162, 0x1563, 0x1164, 0x1565, // 1f8..1ff
+  0x0406, 0x0007, 0x0008, 0x0409, 0x040a, 0x000b, 0x040c, 0x000d, // 200..207
+  0x000e, 0x040f, 0x1010, 0x1411, 0x1412, 0x1013, 0x1414, 0x1015, // 208..20f
+  0x0016, 0x0417, 0x0418, 0x0019, 0x001a, 0x041b, 0x001c, 0x041d, // 210..217
+  0x041e, 0x001f, 0x1020, 0x1421, 0x1422, 0x1023, 0x1424, 0x1025, // 218..21f
+  0x0026, 0x0427, 0x0428, 0x0029, 0x002a, 0x042b, 0x002c, 0x042d, // 220..227
+  0x042e, 0x002f, 0x1430, 0x1031, 0x1032, 0x1433, 0x1034, 0x1435, // 228..22f
+  0x0436, 0x0037, 0x0038, 0x0439, 0x043a, 0x003b, 0x043c, 0x003d, // 230..237
+  0x003e, 0x043f, 0x1040, 0x1441, 0x1442, 0x1043, 0x1444, 0x1045, // 238..23f
+  0x0046, 0x0447, 0x0448, 0x0049, 0x004a, 0x044b, 0x004c, 0x044d, // 240..247
+  0x044e, 0x004f, 0x1450, 0x1051, 0x1052, 0x1453, 0x1054, 0x1455, // 248..24f
+  0x0456, 0x0057, 0x0058, 0x0459, 0x045a, 0x005b, 0x045c, 0x005d, // 250..257
+  0x005e, 0x045f, 0x1460, 0x1061, 0x1062, 0x1463, 0x1064, 0x1465, // 258..25f
+  0x0466, 0x0067, 0x0068, 0x0469, 0x046a, 0x006b, 0x046c, 0x006d, // 260..267
+  0x006e, 0x046f, 0x1070, 0x1471, 0x1472, 0x1073, 0x1474, 0x1075, // 268..26f
+  0x0076, 0x0477, 0x0478, 0x0079, 0x007a, 0x047b, 0x007c, 0x047d, // 270..277
+  0x047e, 0x007f, 0x9080, 0x9481, 0x9482, 0x9083, 0x9484, 0x9085, // 278..27f
+  0x8086, 0x8487, 0x8488, 0x8089, 0x808a, 0x848b, 0x808c, 0x848d, // 280..287
+  0x848e, 0x808f, 0x9490, 0x9091, 0x9092, 0x9493, 0x9094, 0x9495, // 288..28f
+  0x8496, 0x8097, 0x8098, 0x8499, 0x849a, 0x809b, 0x849c, 0x809d, // 290..297
+  0x809e, 0x849f, 0x5500, 0x1101, 0x1102, 0x1503, 0x1104, 0x1505, // 298..29f
+  0x0506, 0x0107, 0x0108, 0x0509, 0x050a, 0x010b, 0x050c, 0x010d, // 2a0..2a7
+  0x010e, 0x050f, 0x1110, 0x1511, 0x1512, 0x1113, 0x1514, 0x1115, // 2a8..2af
+  0x0116, 0x0517, 0x0518, 0x0119, 0x011a, 0x051b, 0x011c, 0x051d, // 2b0..2b7
+  0x051e, 0x011f, 0x1120, 0x1521, 0x1522, 0x1123, 0x1524, 0x1125, // 2b8..2bf
+  0x0126, 0x0527, 0x0528, 0x0129, 0x012a, 0x052b, 0x012c, 0x052d, // 2c0..2c7
+  0x052e, 0x012f, 0x1530, 0x1131, 0x1132, 0x1533, 0x1134, 0x1535, // 2c8..2cf
+  0x0536, 0x0137, 0x0138, 0x0539, 0x053a, 0x013b, 0x053c, 0x013d, // 2d0..2d7
+  0x013e, 0x053f, 0x1140, 0x1541, 0x1542, 0x1143, 0x1544, 0x1145, // 2d8..2df
+  0x0146, 0x0547, 0x0548, 0x0149, 0x014a, 0x054b, 0x014c, 0x054d, // 2e0..2e7
+  0x054e, 0x014f, 0x1550, 0x1151, 0x1152, 0x1553, 0x1154, 0x1555, // 2e8..2ef
+  0x0556, 0x0157, 0x0158, 0x0559, 0x055a, 0x015b, 0x055c, 0x015d, // 2f0..2f7
+  0x015e, 0x055f, 0x1560, 0x1161, 0x1162, 0x1563, 0x1164, 0x1565, // 2f8..2ff
+  0x0566, 0x0167, 0x0168, 0x0569, 0x056a, 0x016b, 0x056c, 0x016d, // 300..307
+  0x016e, 0x056f, 0x1170, 0x1571, 0x1572, 0x1173, 0x1574, 0x1175, // 308..30f
+  0x0176, 0x0577, 0x0578, 0x0179, 0x017a, 0x057b, 0x017c, 0x057d, // 310..317
+  0x057e, 0x017f, 0x9180, 0x9581, 0x9582, 0x9183, 0x9584, 0x9185, // 318..31f
+  0x8186, 0x8587, 0x8588, 0x8189, 0x818a, 0x858b, 0x818c, 0x858d, // 320..327
+  0x858e, 0x818f, 0x9590, 0x9191, 0x9192, 0x9593, 0x9194, 0x9595, // 328..32f
+  0x8596, 0x8197, 0x8198, 0x8599, 0x859a, 0x819b, 0x859c, 0x819d, // 330..337
+  0x819e, 0x859f, 0x95a0, 0x91a1, 0x91a2, 0x95a3, 0x91a4, 0x95a5, // 338..33f
+  0x85a6, 0x81a7, 0x81a8, 0x85a9, 0x85aa, 0x81ab, 0x85ac, 0x81ad, // 340..347
+  0x81ae, 0x85af, 0x91b0, 0x95b1, 0x95b2, 0x91b3, 0x95b4, 0x91b5, // 348..34f
+  0x81b6, 0x85b7, 0x85b8, 0x81b9, 0x81ba, 0x85bb, 0x81bc, 0x85bd, // 350..357
+  0x85be, 0x81bf, 0x95c0, 0x91c1, 0x91c2, 0x95c3, 0x91c4, 0x95c5, // 358..35f
+  0x85c6, 0x81c7, 0x81c8, 0x85c9, 0x85ca, 0x81cb, 0x85cc, 0x81cd, // 360..367
+  0x81ce, 0x85cf, 0x91d0, 0x95d1, 0x95d2, 0x91d3, 0x95d4, 0x91d5, // 368..36f
+  0x81d6, 0x85d7, 0x85d8, 0x81d9, 0x81da, 0x85db, 0x81dc, 0x85dd, // 370..377
+  0x85de, 0x81df, 0x91e0, 0x95e1, 0x95e2, 0x91e3, 0x95e4, 0x91e5, // 378..37f
+  0x81e6, 0x85e7, 0x85e8, 0x81e9, 0x81ea, 0x85eb, 0x81ec, 0x85ed, // 380..387
+  0x85ee, 0x81ef, 0x95f0, 0x91f1, 0x91f2, 0x95f3, 0x91f4, 0x95f5, // 388..38f
+  0x85f6, 0x81f7, 0x81f8, 0x85f9, 0x85fa, 0x81fb, 0x85fc, 0x81fd, // 390..397
+  0x81fe, 0x85ff, 0x5500, 0x1101, 0x1102, 0x1503, 0x1104, 0x1505, // 398..39f
+  0x0506, 0x0107, 0x0108, 0x0509, 0x050a, 0x010b, 0x050c, 0x010d, // 3a0..3a7
+  0x010e, 0x050f, 0x1110, 0x1511, 0x1512, 0x1113, 0x1514, 0x1115, // 3a8..3af
+  0x0116, 0x0517, 0x0518, 0x0119, 0x011a, 0x051b, 0x011c, 0x051d, // 3b0..3b7
+  0x051e, 0x011f, 0x1120, 0x1521, 0x1522, 0x1123, 0x1524, 0x1125, // 3b8..3bf
+  0x0126, 0x0527, 0x0528, 0x0129, 0x012a, 0x052b, 0x012c, 0x052d, // 3c0..3c7
+  0x052e, 0x012f, 0x1530, 0x1131, 0x1132, 0x1533, 0x1134, 0x1535, // 3c8..3cf
+  0x0536, 0x0137, 0x0138, 0x0539, 0x053a, 0x013b, 0x053c, 0x013d, // 3d0..3d7
+  0x013e, 0x053f, 0x1140, 0x1541, 0x1542, 0x1143, 0x1544, 0x1145, // 3d8..3df
+  0x0146, 0x0547, 0x0548, 0x0149, 0x014a, 0x054b, 0x014c, 0x054d, // 3e0..3e7
+  0x054e, 0x014f, 0x1550, 0x1151, 0x1152, 0x1553, 0x1154, 0x1555, // 3e8..3ef
+  0x0556, 0x0157, 0x0158, 0x0559, 0x055a, 0x015b, 0x055c, 0x015d, // 3f0..3f7
+  0x015e, 0x055f, 0x1560, 0x1161, 0x1162, 0x1563, 0x1164, 0x1565, // 3f8..3ff
+};
+
+// 1 for instructions that don't write memory, don't touch the stack, don't do
+// I/O and don't change the interrupt state, a loop made only of these that
+// comes back to the same registers can only be left through an interrupt
+static const uint8_t m8080_pure[] = {
+  1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 00..0f
+  1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 10..1f
+  1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 20..2f
+  1, 1, 0, 1, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 30..3f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 40..4f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 50..5f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 60..6f
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, // 70..7f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 80..8f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 90..9f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // a0..af
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // b0..bf
+  0, 0, 1, 1, 0, 0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0, // c0..cf
+  0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, // d0..df
+  0, 0, 1, 0, 0, 0, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, // e0..ef
+  0, 0, 1, 0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 0, 1, 0, // f0..ff
+};
+
+// size of every instruction in bytes
+static const uint8_t m8080_size[] = {
+  1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 00..0f
+  1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 10..1f
+  1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, // 20..2f
+  1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, // 30..3f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 40..4f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 50..5f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 60..6f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 70..7f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 80..8f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 90..9f
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // a0..af
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // b0..bf
+  1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 3, 3, 3, 2, 1, // c0..cf
+  1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, // d0..df
+  1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1, // e0..ef
+  1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1, // f0..ff
+};
+
+int m8080_instruction_size(const uint8_t opcode) {
+  return m8080_size[opcode];
+}
+
+int m8080_instruction_cycles(const uint8_t opcode) {
+  return m8080_cycles[opcode];
+}
+
 int m8080_disassemble(const m8080* const c, const uint16_t pos, const bool b) {
   const uint8_t opcode = m8080_rb(c, pos);
   const uint8_t byte = m8080_rb(c, pos + 1);
@@ -486,10 +1138,34 @@ static inline uint16_t m8080_next_word(m8080* const c) {
   return ret;
 }
 
-static inline void m8080_set_pzs(m8080* const c, const uint8_t a) {
-  c->f.p = m8080_parity[a];
-  c->f.z = a == 0;
-  c->f.s = a >> 7; // sign bit
+// operands come from the translated `code` instead of memory if there is one
+static inline uint8_t m8080_operand_byte(m8080* const c, const m8080_code* const code) {
+  if(!code) return m8080_next_byte(c);
+  ++c->pc;
+  return code->operand;
+}
+
+static inline uint16_t m8080_operand_word(m8080* const c, const m8080_code* const code) {
+  if(!code) return m8080_next_word(c);
+  c->pc += 2;
+  return code->operand;
+}
+
+// the auxiliary carry is the carry into bit 4, which is bit 4 of the sum
+// without carries (A ^ B) compared to the actual result, conveniently bit 4 is
+// also where the flag is stored
+static inline uint8_t m8080_aux(const uint8_t a, const uint8_t b, const uint8_t res) {
+  return (a ^ b ^ res) & M8080_FLAG_A;
+}
+
+// flags of inr, the carry is not affected
+static inline void m8080_inr_flags(m8080* const c, const uint8_t res) {
+  c->f = (c->f & M8080_FLAG_C) | m8080_szp[res] | ((res & 0x0f) == 0) << 4;
+}
+
+// flags of dcr, the carry is not affected
+static inline void m8080_dcr_flags(m8080* const c, const uint8_t res) {
+  c->f = (c->f & M8080_FLAG_C) | m8080_szp[res] | ((res & 0x0f) != 0x0f) << 4;
 }
 
 // the number in the accumulator is adjusted to form two four-bit binary-coded
@@ -507,68 +1183,55 @@ static inline void m8080_set_pzs(m8080* const c, const uint8_t a) {
 //
 // if a carry occurs during either step, the carry is set; otherwise, it is
 // unaffected
+//
+// every outcome is precomputed in `m8080_daa_table`
 static inline void m8080_daa(m8080* const c) {
-  if(c->f.a || (c->a & 0x0f) > 0x09) {
-    c->f.c |= (c->a + 0x06) >> 8; // carry can be set but not reset
-    c->f.a = ((c->a & 0x0f) + 0x06) >> 4;
-    c->a += 0x06;
-  }
-  if(c->f.c || (c->a & 0xf0) > 0x90) {
-    c->f.c |= (c->a + 0x60) >> 8; // carry can be set but not reset
-    c->a += 0x60;
-  }
-  m8080_set_pzs(c, c->a);
+  const uint16_t r = m8080_daa_table[c->a | (c->f & M8080_FLAG_C) << 8 | (c->f & M8080_FLAG_A) << 5];
+  c->a = r;
+  c->f = r >> 8;
 }
 
 static inline void m8080_add(m8080* const c, const uint8_t a) {
-  c->f.c = (c->a + a) >> 8;
-  c->f.a = ((c->a & 0x0f) + (a & 0x0f)) >> 4;
-  c->a += a;
-  m8080_set_pzs(c, c->a);
+  const uint16_t res = c->a + a;
+  c->f = m8080_szp[res & 0xff] | m8080_aux(c->a, a, res) | res >> 8;
+  c->a = res;
 }
 
 static inline void m8080_adc(m8080* const c, const uint8_t a) {
-  uint8_t tmp = c->f.c;
-  c->f.c = (c->a + a + tmp) >> 8;
-  c->f.a = ((c->a & 0x0f) + (a & 0x0f) + tmp) >> 4;
-  c->a += a + tmp;
-  m8080_set_pzs(c, c->a);
+  const uint16_t res = c->a + a + (c->f & M8080_FLAG_C);
+  c->f = m8080_szp[res & 0xff] | m8080_aux(c->a, a, res) | res >> 8;
+  c->a = res;
 }
 
+// subtraction adds the two's complement, so the auxiliary carry is set when
+// there is no borrow out of the least significant four bits
 static inline void m8080_sub(m8080* const c, const uint8_t a) {
-  c->f.c = (c->a - a) >> 8 & 0x01;
-  c->f.a = ~((c->a & 0x0f) - (a & 0x0f)) >> 4 & 0x01;
-  c->a -= a;
-  m8080_set_pzs(c, c->a);
+  const uint16_t res = c->a - a;
+  c->f = m8080_szp[res & 0xff] | m8080_aux(c->a, ~a, res) | (res >> 8 & 0x01);
+  c->a = res;
 }
 
 static inline void m8080_sbb(m8080* const c, const uint8_t a) {
-  uint8_t tmp = c->f.c;
-  c->f.c = (c->a - a - tmp) >> 8 & 0x01;
-  c->f.a = ~((c->a & 0x0f) - (a & 0x0f) - tmp) >> 4 & 0x01;
-  c->a -= a + tmp;
-  m8080_set_pzs(c, c->a);
+  const uint16_t res = c->a - a - (c->f & M8080_FLAG_C);
+  c->f = m8080_szp[res & 0xff] | m8080_aux(c->a, ~a, res) | (res >> 8 & 0x01);
+  c->a = res;
 }
 
+// the auxiliary carry is set to the logical or of bit 3 of both operands
 static inline void m8080_ana(m8080* const c, const uint8_t a) {
-  c->f.c = 0;
-  c->f.a = (c->a | a) >> 3 & 0x01;
+  const uint8_t aux = (c->a | a) << 1 & M8080_FLAG_A;
   c->a &= a;
-  m8080_set_pzs(c, c->a);
+  c->f = m8080_szp[c->a] | aux;
 }
 
 static inline void m8080_xra(m8080* const c, const uint8_t a) {
   c->a ^= a;
-  m8080_set_pzs(c, c->a);
-  c->f.c = 0;
-  c->f.a = 0;
+  c->f = m8080_szp[c->a];
 }
 
 static inline void m8080_ora(m8080* const c, const uint8_t a) {
   c->a |= a;
-  m8080_set_pzs(c, c->a);
-  c->f.c = 0;
-  c->f.a = 0;
+  c->f = m8080_szp[c->a];
 }
 
 static inline void m8080_cmp(m8080* const c, const uint8_t a) {
@@ -577,30 +1240,35 @@ static inline void m8080_cmp(m8080* const c, const uint8_t a) {
   c->a = tmp;
 }
 
+// sets only the carry, the rotates and dad don't affect the other flags
+static inline void m8080_set_carry(m8080* const c, const uint8_t carry) {
+  c->f = (c->f & ~M8080_FLAG_C) | carry;
+}
+
 // rotate accumulator left
 static inline void m8080_rlc(m8080* const c) {
-  c->f.c = c->a >> 7;
-  c->a = c->a << 1 | c->f.c;
+  m8080_set_carry(c, c->a >> 7);
+  c->a = c->a << 1 | c->a >> 7;
 }
 
 // rotate accumulator right
 static inline void m8080_rrc(m8080* const c) {
-  c->f.c = c->a & 0x01;
-  c->a = c->a >> 1 | c->f.c << 7;
+  m8080_set_carry(c, c->a & 0x01);
+  c->a = c->a >> 1 | c->a << 7;
 }
 
 // rotate accumulator left through carry
 static inline void m8080_ral(m8080* const c) {
   const uint8_t tmp = c->a >> 7;
-  c->a = c->a << 1 | c->f.c;
-  c->f.c = tmp;
+  c->a = c->a << 1 | (c->f & M8080_FLAG_C);
+  m8080_set_carry(c, tmp);
 }
 
 // rotate accumulator right through carry
 static inline void m8080_rar(m8080* const c) {
   const uint8_t tmp = c->a & 0x01;
-  c->a = c->a >> 1 | c->f.c << 7;
-  c->f.c = tmp;
+  c->a = c->a >> 1 | (c->f & M8080_FLAG_C) << 7;
+  m8080_set_carry(c, tmp);
 }
 
 static inline void m8080_push(m8080* const c, const uint16_t a) {
@@ -610,22 +1278,10 @@ static inline void m8080_push(m8080* const c, const uint16_t a) {
 
 // the contents of PSW are saved in two bytes of memory indicated by the stack
 // pointer, the first byte holds the contents of the accumulator and the second
-// byte holds the settings of the five condition bits, the format of this byte
-// is:
-//
-//      +---+---+---+---+---+---+---+---+
-//      |f.s|f.z| 0 |f.a| 0 |f.p| 1 |f.c|
-//      +---+---+---+---+---+---+---+---+
-//
-// note that bit 1 is always 1 and bits 3 and 5 always 0
+// byte holds the settings of the five condition bits, which are already kept
+// in that format (refer to M8080_FLAG_C), except that bit 1 is always 1
 static inline void m8080_push_psw(m8080* const c) {
-  uint16_t tmp = c->a << 8 | 0x02; // bit 1 is always 1
-  tmp |= c->f.c << 0;
-  tmp |= c->f.p << 2;
-  tmp |= c->f.a << 4;
-  tmp |= c->f.z << 6;
-  tmp |= c->f.s << 7;
-  m8080_push(c, tmp);
+  m8080_push(c, c->psw | 0x02);
 }
 
 static inline uint16_t m8080_pop(m8080* const c) {
@@ -635,13 +1291,7 @@ static inline uint16_t m8080_pop(m8080* const c) {
 }
 
 static inline void m8080_pop_psw(m8080* const c) {
-  const uint16_t tmp = m8080_pop(c);
-  c->a = tmp >> 8;
-  c->f.c = tmp >> 0 & 0x01;
-  c->f.p = tmp >> 2 & 0x01;
-  c->f.a = tmp >> 4 & 0x01;
-  c->f.z = tmp >> 6 & 0x01;
-  c->f.s = tmp >> 7 & 0x01;
+  c->psw = m8080_pop(c) & (0xff00 | M8080_FLAGS);
 }
 
 static inline void m8080_xchg(m8080* const c) {
@@ -656,8 +1306,7 @@ static inline void m8080_xthl(m8080* const c) {
   m8080_ww(c, c->sp, tmp);
 }
 
-static inline void m8080_cond_jmp(m8080* const c, const uint8_t condition) {
-  const uint16_t a = m8080_next_word(c);
+static inline void m8080_cond_jmp(m8080* const c, const uint8_t condition, const uint16_t a) {
   if(condition) c->pc = a;
 }
 
@@ -666,8 +1315,7 @@ static inline void m8080_call(m8080* const c, const uint16_t a) {
   c->pc = a;
 }
 
-static inline void m8080_cond_call(m8080* const c, const uint8_t condition) {
-  const uint16_t a = m8080_next_word(c);
+static inline void m8080_cond_call(m8080* const c, const uint8_t condition, const uint16_t a) {
   if(condition) {
     m8080_call(c, a);
     c->cycles += 6;
@@ -681,47 +1329,189 @@ static inline void m8080_cond_ret(m8080* const c, const uint8_t condition) {
   }
 }
 
-size_t m8080_step(m8080* const c) {
-  const uint8_t opcode = m8080_next_byte(c);
-  const size_t previous_cycle = c->cycles;
+static inline void m8080_port_in(m8080* const c, const uint8_t a) {
+  if(!c->ports) {
+    m8080_in(c, a);
+    return;
+  }
+  const m8080_port* const p = &c->ports[a];
+  c->a = p->in ? p->in(c, p->ctx, a) : p->value;
+}
+
+static inline void m8080_port_out(m8080* const c, const uint8_t a) {
+  if(!c->ports) {
+    m8080_out(c, a);
+    return;
+  }
+  m8080_port* const p = &c->ports[a];
+  if(p->out) p->out(c, p->ctx, a, c->a);
+  else p->latch = c->a;
+}
+
+void m8080_suspend(m8080* const c) {
+  // in and out are both two bytes and 10 cycles
+  c->pc -= 2;
+  c->cycles -= 10;
+  c->suspended = 1;
+}
+
+void m8080_resume(m8080* const c, const uint8_t b) {
+  if(!c->suspended) return;
+  c->suspended = 0;
+  if(m8080_rb(c, c->pc) == 0xdb) c->a = b;
+  c->pc += 2;
+  c->cycles += 10;
+}
+
+// superinstructions, the most frequent pairs of instructions in the bundled
+// test ROMs (counted with examples/pairs.c) are run by `m8080_run` without
+// going back through the loop and the `switch` for the second one:
+//
+//      inr/dcr r, cmp r or cpi followed by jnz, jz, jnc or jc   11.6%
+//      push followed by push                                     5.0%
+//      pop followed by pop                                       3.9%
+//      inx followed by inx                                       1.9%
+//
+// the second instruction only runs right away before `fuse`, the deadline of
+// the slice, and with no interrupt waiting, that is, when the run loop would
+// have run it next anyway, so every instruction has the same result it would
+// have had on its own and `m8080_step` (passing a deadline of 0) never fuses
+//
+// only pairs whose second opcode is cheap to look at are fused, that is with
+// M8080_EXTERN_CALLBACKS or from a translated ROM, through the callback table
+// every pair that isn't completed reads the opcode twice with an indirect call
+// and that costs more than the completed ones save (the 8080EXER tests run
+// 10% to 20% slower fused, only CPUTEST gains)
+//
+// a pair that isn't completed has its second opcode read twice, so outside of
+// a translated ROM pairs are only fused when `fast_forward` says reading has
+// no side effects
+
+// the next instruction is peeked and, if it doesn't complete the pair, left
+// to be fetched again as usual, it comes from the entry after `code` if that
+// one is translated too, a nop (which completes no pair) stands in for it if
+// it can only be read through the callback table or reading it twice could be
+// told apart from reading it once
+static inline const m8080_code* m8080_peek(const m8080* const c, const m8080_code* const code,
+    uint8_t* const opcode) {
+  if(code && code[code->size].size) {
+    *opcode = code[code->size].opcode;
+    return &code[code->size];
+  }
+#ifdef M8080_EXTERN_CALLBACKS
+  *opcode = c->fast_forward ? m8080_rb(c, c->pc) : 0x00;
+#else
+  *opcode = 0x00;
+#endif
+  return NULL;
+}
+
+static inline void m8080_fuse_jump(m8080* const c, const uint64_t fuse, const m8080_code* const code) {
+  if(c->cycles >= fuse || c->attention) return;
+  uint8_t opcode;
+  const m8080_code* const next = m8080_peek(c, code, &opcode);
+  uint8_t condition;
+  switch(opcode) {
+  case 0xc2: condition = !(c->f & M8080_FLAG_Z); break; // jnz
+  case 0xca: condition = c->f & M8080_FLAG_Z; break; // jz
+  case 0xd2: condition = !(c->f & M8080_FLAG_C); break; // jnc
+  case 0xda: condition = c->f & M8080_FLAG_C; break; // jc
+  default: return;
+  }
+  ++c->pc;
+  c->cycles += m8080_cycles[opcode];
+  m8080_cond_jmp(c, condition, m8080_operand_word(c, next));
+}
+
+static inline void m8080_fuse_push(m8080* const c, const uint64_t fuse, const m8080_code* const code) {
+  if(c->cycles >= fuse || c->attention) return;
+  uint8_t opcode;
+  m8080_peek(c, code, &opcode);
+  uint16_t value;
+  switch(opcode) {
+  case 0xc5: value = c->bc; break; // push bc
+  case 0xd5: value = c->de; break; // push de
+  case 0xe5: value = c->hl; break; // push hl
+  case 0xf5: value = c->psw | 0x02; break; // push psw
+  default: return;
+  }
+  ++c->pc;
+  c->cycles += m8080_cycles[opcode];
+  m8080_push(c, value);
+}
+
+static inline void m8080_fuse_pop(m8080* const c, const uint64_t fuse, const m8080_code* const code) {
+  if(c->cycles >= fuse || c->attention) return;
+  uint8_t opcode;
+  m8080_peek(c, code, &opcode);
+  switch(opcode) {
+  case 0xc1: c->bc = m8080_pop(c); break; // pop bc
+  case 0xd1: c->de = m8080_pop(c); break; // pop de
+  case 0xe1: c->hl = m8080_pop(c); break; // pop hl
+  case 0xf1: m8080_pop_psw(c); break; // pop psw
+  default: return;
+  }
+  ++c->pc;
+  c->cycles += m8080_cycles[opcode];
+}
+
+static inline void m8080_fuse_inx(m8080* const c, const uint64_t fuse, const m8080_code* const code) {
+  if(c->cycles >= fuse || c->attention) return;
+  uint8_t opcode;
+  m8080_peek(c, code, &opcode);
+  switch(opcode) {
+  case 0x03: ++c->bc; break; // inx bc
+  case 0x13: ++c->de; break; // inx de
+  case 0x23: ++c->hl; break; // inx hl
+  case 0x33: ++c->sp; break; // inx sp
+  default: return;
+  }
+  ++c->pc;
+  c->cycles += m8080_cycles[opcode];
+}
+
+// executes an already fetched opcode, and the instruction after it if the two
+// are a superinstruction and the cycle count is below `fuse`, the operands are
+// read from `code` if it isn't null
+static M8080_ALWAYS_INLINE size_t m8080_execute(m8080* const c, const uint8_t opcode, const uint64_t fuse,
+    const m8080_code* const code) {
+  const uint64_t previous_cycle = c->cycles;
   c->cycles += m8080_cycles[opcode];
 
   switch(opcode) {
   // set carry
-  case 0x37: c->f.c = 1; break; // stc
+  case 0x37: c->f |= M8080_FLAG_C; break; // stc
 
   // complement carry
-  case 0x3f: c->f.c = !c->f.c; break; // cmc
+  case 0x3f: c->f ^= M8080_FLAG_C; break; // cmc
 
   // increment register or memory
-  case 0x04: ++c->b; c->f.a = (c->b & 0x0f) == 0; m8080_set_pzs(c, c->b); break; // inr b
-  case 0x0c: ++c->c; c->f.a = (c->c & 0x0f) == 0; m8080_set_pzs(c, c->c); break; // inr c
-  case 0x14: ++c->d; c->f.a = (c->d & 0x0f) == 0; m8080_set_pzs(c, c->d); break; // inr d
-  case 0x1c: ++c->e; c->f.a = (c->e & 0x0f) == 0; m8080_set_pzs(c, c->e); break; // inr e
-  case 0x24: ++c->h; c->f.a = (c->h & 0x0f) == 0; m8080_set_pzs(c, c->h); break; // inr h
-  case 0x2c: ++c->l; c->f.a = (c->l & 0x0f) == 0; m8080_set_pzs(c, c->l); break; // inr l
+  case 0x04: ++c->b; m8080_inr_flags(c, c->b); m8080_fuse_jump(c, fuse, code); break; // inr b
+  case 0x0c: ++c->c; m8080_inr_flags(c, c->c); m8080_fuse_jump(c, fuse, code); break; // inr c
+  case 0x14: ++c->d; m8080_inr_flags(c, c->d); m8080_fuse_jump(c, fuse, code); break; // inr d
+  case 0x1c: ++c->e; m8080_inr_flags(c, c->e); m8080_fuse_jump(c, fuse, code); break; // inr e
+  case 0x24: ++c->h; m8080_inr_flags(c, c->h); m8080_fuse_jump(c, fuse, code); break; // inr h
+  case 0x2c: ++c->l; m8080_inr_flags(c, c->l); m8080_fuse_jump(c, fuse, code); break; // inr l
   case 0x34: { // inr [hl]
     const uint8_t res = m8080_rb(c, c->hl) + 1;
     m8080_wb(c, c->hl, res);
-    c->f.a = (res & 0x0f) == 0;
-    m8080_set_pzs(c, res);
+    m8080_inr_flags(c, res);
   } break;
-  case 0x3c: ++c->a; c->f.a = (c->a & 0x0f) == 0; m8080_set_pzs(c, c->a); break; // inr a
+  case 0x3c: ++c->a; m8080_inr_flags(c, c->a); m8080_fuse_jump(c, fuse, code); break; // inr a
 
   // decrement register or memory
-  case 0x05: --c->b; c->f.a = (c->b & 0x0f) != 0x0f; m8080_set_pzs(c, c->b); break; // dcr b
-  case 0x0d: --c->c; c->f.a = (c->c & 0x0f) != 0x0f; m8080_set_pzs(c, c->c); break; // dcr c
-  case 0x15: --c->d; c->f.a = (c->d & 0x0f) != 0x0f; m8080_set_pzs(c, c->d); break; // dcr d
-  case 0x1d: --c->e; c->f.a = (c->e & 0x0f) != 0x0f; m8080_set_pzs(c, c->e); break; // dcr e
-  case 0x25: --c->h; c->f.a = (c->h & 0x0f) != 0x0f; m8080_set_pzs(c, c->h); break; // dcr h
-  case 0x2d: --c->l; c->f.a = (c->l & 0x0f) != 0x0f; m8080_set_pzs(c, c->l); break; // dcr l
+  case 0x05: --c->b; m8080_dcr_flags(c, c->b); m8080_fuse_jump(c, fuse, code); break; // dcr b
+  case 0x0d: --c->c; m8080_dcr_flags(c, c->c); m8080_fuse_jump(c, fuse, code); break; // dcr c
+  case 0x15: --c->d; m8080_dcr_flags(c, c->d); m8080_fuse_jump(c, fuse, code); break; // dcr d
+  case 0x1d: --c->e; m8080_dcr_flags(c, c->e); m8080_fuse_jump(c, fuse, code); break; // dcr e
+  case 0x25: --c->h; m8080_dcr_flags(c, c->h); m8080_fuse_jump(c, fuse, code); break; // dcr h
+  case 0x2d: --c->l; m8080_dcr_flags(c, c->l); m8080_fuse_jump(c, fuse, code); break; // dcr l
   case 0x35: { // dcr [hl]
     const uint8_t res = m8080_rb(c, c->hl) - 1;
     m8080_wb(c, c->hl, res);
-    c->f.a = (res & 0x0f) != 0x0f;
-    m8080_set_pzs(c, res);
+    m8080_dcr_flags(c, res);
   } break;
-  case 0x3d: --c->a; c->f.a = (c->a & 0x0f) != 0x0f; m8080_set_pzs(c, c->a); break; // dcr a
+  case 0x3d: --c->a; m8080_dcr_flags(c, c->a); m8080_fuse_jump(c, fuse, code); break; // dcr a
 
   // complement accumulator
   case 0x2f: c->a = ~c->a; break; // cma
@@ -731,13 +1521,14 @@ size_t m8080_step(m8080* const c) {
 
   // no operation instructions
   case 0x00: break; // nop
-  case 0x08: break; // nop
-  case 0x10: break; // nop
-  case 0x18: break; // nop
-  case 0x20: break; // nop
-  case 0x28: break; // nop
-  case 0x30: break; // nop
-  case 0x38: break; // nop
+
+  // undocumented no operation instructions, also used as traps
+  case 0x08: case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+    if(c->cb && c->cb->trap) {
+      c->cycles = previous_cycle;
+      c->cb->trap(c, opcode);
+    }
+    break; // nop
 
   // move
   case 0x40: c->b = c->b; break; // mov b, b
@@ -883,14 +1674,14 @@ size_t m8080_step(m8080* const c) {
   case 0xb7: m8080_ora(c, c->a); break; // ora a
 
   // compare register or memory with accumulator
-  case 0xb8: m8080_cmp(c, c->b); break; // cmp b
-  case 0xb9: m8080_cmp(c, c->c); break; // cmp c
-  case 0xba: m8080_cmp(c, c->d); break; // cmp d
-  case 0xbb: m8080_cmp(c, c->e); break; // cmp e
-  case 0xbc: m8080_cmp(c, c->h); break; // cmp h
-  case 0xbd: m8080_cmp(c, c->l); break; // cmp l
+  case 0xb8: m8080_cmp(c, c->b); m8080_fuse_jump(c, fuse, code); break; // cmp b
+  case 0xb9: m8080_cmp(c, c->c); m8080_fuse_jump(c, fuse, code); break; // cmp c
+  case 0xba: m8080_cmp(c, c->d); m8080_fuse_jump(c, fuse, code); break; // cmp d
+  case 0xbb: m8080_cmp(c, c->e); m8080_fuse_jump(c, fuse, code); break; // cmp e
+  case 0xbc: m8080_cmp(c, c->h); m8080_fuse_jump(c, fuse, code); break; // cmp h
+  case 0xbd: m8080_cmp(c, c->l); m8080_fuse_jump(c, fuse, code); break; // cmp l
   case 0xbe: m8080_cmp(c, m8080_rb(c, c->hl)); break; // cmp [hl]
-  case 0xbf: m8080_cmp(c, c->a); break; // cmp a
+  case 0xbf: m8080_cmp(c, c->a); m8080_fuse_jump(c, fuse, code); break; // cmp a
 
   // rotate accumulator instructions
   case 0x07: m8080_rlc(c); break; // rlc
@@ -899,28 +1690,28 @@ size_t m8080_step(m8080* const c) {
   case 0x1f: m8080_rar(c); break; // rar
 
   // push data onto stack
-  case 0xc5: m8080_push(c, c->bc); break; // push bc
-  case 0xd5: m8080_push(c, c->de); break; // push de
-  case 0xe5: m8080_push(c, c->hl); break; // push hl
-  case 0xf5: m8080_push_psw(c); break; // push psw
+  case 0xc5: m8080_push(c, c->bc); m8080_fuse_push(c, fuse, code); break; // push bc
+  case 0xd5: m8080_push(c, c->de); m8080_fuse_push(c, fuse, code); break; // push de
+  case 0xe5: m8080_push(c, c->hl); m8080_fuse_push(c, fuse, code); break; // push hl
+  case 0xf5: m8080_push_psw(c); m8080_fuse_push(c, fuse, code); break; // push psw
 
   // pop data off stack
-  case 0xc1: c->bc = m8080_pop(c); break; // pop bc
-  case 0xd1: c->de = m8080_pop(c); break; // pop de
-  case 0xe1: c->hl = m8080_pop(c); break; // pop hl
-  case 0xf1: m8080_pop_psw(c); break; // pop psw
+  case 0xc1: c->bc = m8080_pop(c); m8080_fuse_pop(c, fuse, code); break; // pop bc
+  case 0xd1: c->de = m8080_pop(c); m8080_fuse_pop(c, fuse, code); break; // pop de
+  case 0xe1: c->hl = m8080_pop(c); m8080_fuse_pop(c, fuse, code); break; // pop hl
+  case 0xf1: m8080_pop_psw(c); m8080_fuse_pop(c, fuse, code); break; // pop psw
 
   // double add
-  case 0x09: c->f.c = (c->hl + c->bc) >> 16; c->hl += c->bc; break; // dad bc
-  case 0x19: c->f.c = (c->hl + c->de) >> 16; c->hl += c->de; break; // dad de
-  case 0x29: c->f.c = (c->hl + c->hl) >> 16; c->hl += c->hl; break; // dad hl
-  case 0x39: c->f.c = (c->hl + c->sp) >> 16; c->hl += c->sp; break; // dad sp
+  case 0x09: m8080_set_carry(c, (c->hl + c->bc) >> 16); c->hl += c->bc; break; // dad bc
+  case 0x19: m8080_set_carry(c, (c->hl + c->de) >> 16); c->hl += c->de; break; // dad de
+  case 0x29: m8080_set_carry(c, (c->hl + c->hl) >> 16); c->hl += c->hl; break; // dad hl
+  case 0x39: m8080_set_carry(c, (c->hl + c->sp) >> 16); c->hl += c->sp; break; // dad sp
 
   // increment register pair
-  case 0x03: ++c->bc; break; // inx bc
-  case 0x13: ++c->de; break; // inx de
-  case 0x23: ++c->hl; break; // inx hl
-  case 0x33: ++c->sp; break; // inx sp
+  case 0x03: ++c->bc; m8080_fuse_inx(c, fuse, code); break; // inx bc
+  case 0x13: ++c->de; m8080_fuse_inx(c, fuse, code); break; // inx de
+  case 0x23: ++c->hl; m8080_fuse_inx(c, fuse, code); break; // inx hl
+  case 0x33: ++c->sp; m8080_fuse_inx(c, fuse, code); break; // inx sp
 
   // decrement register pair
   case 0x0b: --c->bc; break; // dcx bc
@@ -934,79 +1725,79 @@ size_t m8080_step(m8080* const c) {
   case 0xf9: c->sp = c->hl; break; // sphl
 
   // move immediate word
-  case 0x01: c->bc = m8080_next_word(c); break; // lxi bc, word
-  case 0x11: c->de = m8080_next_word(c); break; // lxi de, word
-  case 0x21: c->hl = m8080_next_word(c); break; // lxi hl, word
-  case 0x31: c->sp = m8080_next_word(c); break; // lxi sp, word
+  case 0x01: c->bc = m8080_operand_word(c, code); break; // lxi bc, word
+  case 0x11: c->de = m8080_operand_word(c, code); break; // lxi de, word
+  case 0x21: c->hl = m8080_operand_word(c, code); break; // lxi hl, word
+  case 0x31: c->sp = m8080_operand_word(c, code); break; // lxi sp, word
 
   // move immediate byte
-  case 0x06: c->b = m8080_next_byte(c); break; // mvi b, byte
-  case 0x0e: c->c = m8080_next_byte(c); break; // mvi c, byte
-  case 0x16: c->d = m8080_next_byte(c); break; // mvi d, byte
-  case 0x1e: c->e = m8080_next_byte(c); break; // mvi e, byte
-  case 0x26: c->h = m8080_next_byte(c); break; // mvi h, byte
-  case 0x2e: c->l = m8080_next_byte(c); break; // mvi l, byte
-  case 0x36: m8080_wb(c, c->hl, m8080_next_byte(c)); break; // mvi [hl], byte
-  case 0x3e: c->a = m8080_next_byte(c); break; // mvi a, byte
+  case 0x06: c->b = m8080_operand_byte(c, code); break; // mvi b, byte
+  case 0x0e: c->c = m8080_operand_byte(c, code); break; // mvi c, byte
+  case 0x16: c->d = m8080_operand_byte(c, code); break; // mvi d, byte
+  case 0x1e: c->e = m8080_operand_byte(c, code); break; // mvi e, byte
+  case 0x26: c->h = m8080_operand_byte(c, code); break; // mvi h, byte
+  case 0x2e: c->l = m8080_operand_byte(c, code); break; // mvi l, byte
+  case 0x36: m8080_wb(c, c->hl, m8080_operand_byte(c, code)); break; // mvi [hl], byte
+  case 0x3e: c->a = m8080_operand_byte(c, code); break; // mvi a, byte
 
   // immediate instructions
-  case 0xc6: m8080_add(c, m8080_next_byte(c)); break; // adi byte
-  case 0xce: m8080_adc(c, m8080_next_byte(c)); break; // aci byte
-  case 0xd6: m8080_sub(c, m8080_next_byte(c)); break; // sui byte
-  case 0xde: m8080_sbb(c, m8080_next_byte(c)); break; // sbi byte
-  case 0xe6: m8080_ana(c, m8080_next_byte(c)); break; // ani byte
-  case 0xee: m8080_xra(c, m8080_next_byte(c)); break; // xri byte
-  case 0xf6: m8080_ora(c, m8080_next_byte(c)); break; // ori byte
-  case 0xfe: m8080_cmp(c, m8080_next_byte(c)); break; // cpi byte
+  case 0xc6: m8080_add(c, m8080_operand_byte(c, code)); break; // adi byte
+  case 0xce: m8080_adc(c, m8080_operand_byte(c, code)); break; // aci byte
+  case 0xd6: m8080_sub(c, m8080_operand_byte(c, code)); break; // sui byte
+  case 0xde: m8080_sbb(c, m8080_operand_byte(c, code)); break; // sbi byte
+  case 0xe6: m8080_ana(c, m8080_operand_byte(c, code)); break; // ani byte
+  case 0xee: m8080_xra(c, m8080_operand_byte(c, code)); break; // xri byte
+  case 0xf6: m8080_ora(c, m8080_operand_byte(c, code)); break; // ori byte
+  case 0xfe: m8080_cmp(c, m8080_operand_byte(c, code)); m8080_fuse_jump(c, fuse, code); break; // cpi byte
 
   // store/load accumulator direct
-  case 0x32: m8080_wb(c, m8080_next_word(c), c->a); break; // sta word
-  case 0x3a: c->a = m8080_rb(c, m8080_next_word(c)); break; // lda word
+  case 0x32: m8080_wb(c, m8080_operand_word(c, code), c->a); break; // sta word
+  case 0x3a: c->a = m8080_rb(c, m8080_operand_word(c, code)); break; // lda word
 
   // store/load hl direct
-  case 0x22: m8080_ww(c, m8080_next_word(c), c->hl); break; // shld word
-  case 0x2a: c->hl = m8080_rw(c, m8080_next_word(c)); break; // lhld word
+  case 0x22: m8080_ww(c, m8080_operand_word(c, code), c->hl); break; // shld word
+  case 0x2a: c->hl = m8080_rw(c, m8080_operand_word(c, code)); break; // lhld word
 
   // load program counter
   case 0xe9: c->pc = c->hl; break; // pchl
 
   // jump instructions
-  case 0xc3: c->pc = m8080_next_word(c); break; // jmp word
-  case 0xcb: c->pc = m8080_next_word(c); break; // jmp word
-  case 0xda: m8080_cond_jmp(c, c->f.c == 1); break; // jc word
-  case 0xd2: m8080_cond_jmp(c, c->f.c == 0); break; // jnc word
-  case 0xca: m8080_cond_jmp(c, c->f.z == 1); break; // jz word
-  case 0xc2: m8080_cond_jmp(c, c->f.z == 0); break; // jnz word
-  case 0xfa: m8080_cond_jmp(c, c->f.s == 1); break; // jm word
-  case 0xf2: m8080_cond_jmp(c, c->f.s == 0); break; // jp word
-  case 0xea: m8080_cond_jmp(c, c->f.p == 1); break; // jpe word
-  case 0xe2: m8080_cond_jmp(c, c->f.p == 0); break; // jpo word
+  case 0xc3: c->pc = m8080_operand_word(c, code); break; // jmp word
+  case 0xcb: c->pc = m8080_operand_word(c, code); break; // jmp word
+  case 0xda: m8080_cond_jmp(c, c->f & M8080_FLAG_C, m8080_operand_word(c, code)); break; // jc word
+  case 0xd2: m8080_cond_jmp(c, !(c->f & M8080_FLAG_C), m8080_operand_word(c, code)); break; // jnc word
+  case 0xca: m8080_cond_jmp(c, c->f & M8080_FLAG_Z, m8080_operand_word(c, code)); break; // jz word
+  case 0xc2: m8080_cond_jmp(c, !(c->f & M8080_FLAG_Z), m8080_operand_word(c, code)); break; // jnz word
+  case 0xfa: m8080_cond_jmp(c, c->f & M8080_FLAG_S, m8080_operand_word(c, code)); break; // jm word
+  case 0xf2: m8080_cond_jmp(c, !(c->f & M8080_FLAG_S), m8080_operand_word(c, code)); break; // jp word
+  case 0xea: m8080_cond_jmp(c, c->f & M8080_FLAG_P, m8080_operand_word(c, code)); break; // jpe word
+  case 0xe2: m8080_cond_jmp(c, !(c->f & M8080_FLAG_P), m8080_operand_word(c, code)); break; // jpo word
 
   // call subroutine instructions
-  case 0xcd: m8080_call(c, m8080_next_word(c)); break; // call word
-  case 0xdd: m8080_call(c, m8080_next_word(c)); break; // call word
-  case 0xed: m8080_call(c, m8080_next_word(c)); break; // call word
-  case 0xfd: m8080_call(c, m8080_next_word(c)); break; // call word
-  case 0xdc: m8080_cond_call(c, c->f.c == 1); break; // cc word
-  case 0xd4: m8080_cond_call(c, c->f.c == 0); break; // cnc word
-  case 0xcc: m8080_cond_call(c, c->f.z == 1); break; // cz word
-  case 0xc4: m8080_cond_call(c, c->f.z == 0); break; // cnz word
-  case 0xfc: m8080_cond_call(c, c->f.s == 1); break; // cm word
-  case 0xf4: m8080_cond_call(c, c->f.s == 0); break; // cp word
-  case 0xec: m8080_cond_call(c, c->f.p == 1); break; // cpe word
-  case 0xe4: m8080_cond_call(c, c->f.p == 0); break; // cpo word
+  case 0xcd: m8080_call(c, m8080_operand_word(c, code)); break; // call word
+  case 0xdd: m8080_call(c, m8080_operand_word(c, code)); break; // call word
+  case 0xed: m8080_call(c, m8080_operand_word(c, code)); break; // call word
+  case 0xfd: m8080_call(c, m8080_operand_word(c, code)); break; // call word
+  case 0xdc: m8080_cond_call(c, c->f & M8080_FLAG_C, m8080_operand_word(c, code)); break; // cc word
+  case 0xd4: m8080_cond_call(c, !(c->f & M8080_FLAG_C), m8080_operand_word(c, code)); break; // cnc word
+  case 0xcc: m8080_cond_call(c, c->f & M8080_FLAG_Z, m8080_operand_word(c, code)); break; // cz word
+  case 0xc4: m8080_cond_call(c, !(c->f & M8080_FLAG_Z), m8080_operand_word(c, code)); break; // cnz word
+  case 0xfc: m8080_cond_call(c, c->f & M8080_FLAG_S, m8080_operand_word(c, code)); break; // cm word
+  case 0xf4: m8080_cond_call(c, !(c->f & M8080_FLAG_S), m8080_operand_word(c, code)); break; // cp word
+  case 0xec: m8080_cond_call(c, c->f & M8080_FLAG_P, m8080_operand_word(c, code)); break; // cpe word
+  case 0xe4: m8080_cond_call(c, !(c->f & M8080_FLAG_P), m8080_operand_word(c, code)); break; // cpo word
 
   // return from subroutine instructions
   case 0xc9: c->pc = m8080_pop(c); break; // ret
   case 0xd9: c->pc = m8080_pop(c); break; // ret
-  case 0xd8: m8080_cond_ret(c, c->f.c == 1); break; // rc
-  case 0xd0: m8080_cond_ret(c, c->f.c == 0); break; // rnc
-  case 0xc8: m8080_cond_ret(c, c->f.z == 1); break; // rz
-  case 0xc0: m8080_cond_ret(c, c->f.z == 0); break; // rnz
-  case 0xf8: m8080_cond_ret(c, c->f.s == 1); break; // rm
-  case 0xf0: m8080_cond_ret(c, c->f.s == 0); break; // rp
-  case 0xe8: m8080_cond_ret(c, c->f.p == 1); break; // rpe
-  case 0xe0: m8080_cond_ret(c, c->f.p == 0); break; // rpo
+  case 0xd8: m8080_cond_ret(c, c->f & M8080_FLAG_C); break; // rc
+  case 0xd0: m8080_cond_ret(c, !(c->f & M8080_FLAG_C)); break; // rnc
+  case 0xc8: m8080_cond_ret(c, c->f & M8080_FLAG_Z); break; // rz
+  case 0xc0: m8080_cond_ret(c, !(c->f & M8080_FLAG_Z)); break; // rnz
+  case 0xf8: m8080_cond_ret(c, c->f & M8080_FLAG_S); break; // rm
+  case 0xf0: m8080_cond_ret(c, !(c->f & M8080_FLAG_S)); break; // rp
+  case 0xe8: m8080_cond_ret(c, c->f & M8080_FLAG_P); break; // rpe
+  case 0xe0: m8080_cond_ret(c, !(c->f & M8080_FLAG_P)); break; // rpo
 
   // restart instructions
   case 0xc7: m8080_call(c, M8080_RST_0); break; // rst 0
@@ -1019,30 +1810,642 @@ size_t m8080_step(m8080* const c) {
   case 0xff: m8080_call(c, M8080_RST_7); break; // rst 7
 
   // interrupt flip-flop instructions
-  case 0xfb: c->inte = 1; break; // ei
-  case 0xf3: c->inte = 0; break; // di
+  // ei always tells `m8080_run` to look, the instruction after it runs first
+  case 0xfb: c->inte = 1; c->ready = 2; break; // ei
+  case 0xf3: c->inte = 0; c->ready = 0; break; // di
 
-  // input/output instructions (user-defined)
-  case 0xdb: m8080_in(c, m8080_next_byte(c)); break; // in byte
-  case 0xd3: m8080_out(c, m8080_next_byte(c)); break; // out byte
+  // input/output instructions (port table or user-defined)
+  case 0xdb: m8080_port_in(c, m8080_operand_byte(c, code)); break; // in byte
+  case 0xd3: m8080_port_out(c, m8080_operand_byte(c, code)); break; // out byte
 
-  // halt instruction (user-defined)
-  case 0x76: m8080_hlt(c); break; // hlt
+  // halt instruction, the program counter stays on hlt until an interrupt
+  case 0x76: c->halted = 1; --c->pc; m8080_hlt(c); break; // hlt
   }
 
   return c->cycles - previous_cycle;
 }
 
+size_t m8080_step(m8080* const c) {
+  return m8080_execute(c, m8080_next_byte(c), 0, NULL);
+}
+
+// longest backward jump considered a candidate idle loop
+#define M8080_IDLE_LOOP 16
+
+static inline bool m8080_same_registers(const m8080* const x, const m8080* const y) {
+  return x->a == y->a && x->bc == y->bc && x->de == y->de && x->hl == y->hl
+    && x->sp == y->sp && x->pc == y->pc && x->inte == y->inte && x->f == y->f;
+}
+
+// runs one iteration of the loop starting at the program counter, if it only
+// executed pure instructions and came back to exactly the same registers,
+// every following iteration will do the same, so they are skipped as long as
+// they fit before `end`
+//
+// returns false if the loop is not idle, `*late` is set instead if the
+// iteration couldn't be completed before `end`
+static inline bool m8080_idle(m8080* const c, const uint64_t end, bool* const late) {
+  const m8080 before = *c;
+  for(size_t i = 0; i < M8080_IDLE_LOOP; ++i) {
+    const uint8_t opcode = m8080_rb(c, c->pc);
+    // reading a port without an `in` handler has no side effects either
+    const bool pure = m8080_pure[opcode] || (opcode == 0xdb && c->ports
+        && !c->ports[m8080_rb(c, c->pc + 1)].in);
+    if(!pure || (c->cb && c->cb->trap && m8080_is_trap(opcode))) return false;
+    m8080_step(c);
+    if(c->pc == before.pc) break;
+    if(c->cycles >= end) {
+      *late = true;
+      return false;
+    }
+  }
+  if(!m8080_same_registers(c, &before)) return false;
+
+  const uint64_t iteration = c->cycles - before.cycles;
+  if(c->cycles < end) c->cycles += (end - c->cycles) / iteration * iteration;
+  return true;
+}
+
+// called when `c->attention` is set, takes a pending interrupt if there is one
+// and returns true if it executed anything
+static bool m8080_acknowledge(m8080* const c) {
+  if(c->ready == 2) {
+    // the instruction after ei, unless it is ei or di, leaves the CPU ready
+    // if there is anything to take
+    c->ready = 1;
+    m8080_step(c);
+    if(c->ready == 1 && !c->irq) c->ready = 0;
+    return true;
+  }
+  if(!c->ready) return false;
+
+  uint8_t line = 7;
+  while(!(c->irq & 1 << line)) --line;
+  c->irq &= ~(1 << line);
+  c->ready = 0;
+  c->inte = 0;
+  if(c->halted) {
+    c->halted = 0;
+    ++c->pc;
+  }
+
+  const uint16_t a = c->cb && c->cb->inta ? c->cb->inta(c, line) : line * 8;
+  m8080_call(c, a);
+  // rst or call
+  c->cycles += (a & 0xffc7) == 0 ? 11 : 17;
+  return true;
+}
+
+// the translated entry for address A, null if there is none
+static inline const m8080_code* m8080_rom_code(const m8080_rom* const r, const uint16_t a) {
+  const uint16_t i = a - r->base;
+  return i < r->size && r->code[i].size ? &r->code[i] : NULL;
+}
+
+static void m8080_rom_take(m8080_rom* const r, const m8080* const c, const uint16_t i);
+
+// shared by `m8080_run_until` and `m8080_rom_run_until`, `r` is null for the
+// former so that only the plain fetch is left in it
+static M8080_ALWAYS_INLINE uint64_t m8080_run_loop(m8080* const c, m8080_rom* const r,
+    const uint64_t deadline) {
+  const uint64_t previous_cycle = c->cycles;
+  // the loop compares against the argument rather than reloading the field
+  c->deadline = deadline;
+  // loops that were found not to be idle are not checked again, if the same
+  // loop is running the next time `m8080_run` is called it is checked again
+  size_t rejected = 0x10000;
+
+  while(c->cycles < deadline) {
+    if(c->attention) {
+      if(c->suspended) break;
+      if(m8080_acknowledge(c)) continue;
+    }
+    if(c->halted) {
+      // exactly as many hlt instructions as would have executed
+      const uint64_t hlt = m8080_cycles[0x76];
+      c->cycles += (deadline - c->cycles + hlt - 1) / hlt * hlt;
+      break;
+    }
+
+    const uint16_t pc = c->pc;
+    const m8080_code* code;
+    if(!r) {
+      m8080_execute(c, m8080_next_byte(c), deadline, NULL);
+    } else if((code = m8080_rom_code(r, pc))) {
+      ++c->pc;
+      m8080_execute(c, code->opcode, deadline, code);
+    } else {
+      // ROM the translation missed is translated once, if that doesn't work
+      // (it runs into a written byte or the end of the ROM) it is not tried
+      // again, a loaded translation is looked at first
+      const uint16_t i = pc - r->base;
+      if(i < r->size && !r->skip[i] && !r->failed[i]) {
+        m8080_rom_take(r, c, i);
+        if(!r->code[i].size && !m8080_rom_translate(r, c, pc)) r->failed[i] = 1;
+      }
+      m8080_step(c);
+    }
+    // a jump to itself (jmp $) is the shortest idle loop
+    if(c->fast_forward && c->pc <= pc && pc - c->pc <= M8080_IDLE_LOOP
+        && c->pc != rejected && c->cycles < deadline) {
+      bool late = false;
+      if(!m8080_idle(c, deadline, &late) && !late) rejected = c->pc;
+    }
+  }
+
+  return c->cycles - previous_cycle;
+}
+
+uint64_t m8080_run_until(m8080* const c, const uint64_t deadline) {
+  return m8080_run_loop(c, NULL, deadline);
+}
+
+uint64_t m8080_run(m8080* const c, const uint64_t cycles) {
+  return m8080_run_until(c, m8080_next_deadline(c, cycles));
+}
+
+int m8080_watch_next(m8080* const c, const uint64_t deadline, m8080_watch* const w) {
+  w->cycles = c->cycles;
+  w->pc = c->pc;
+  w->sp = c->sp;
+  w->opcode = 0x00;
+  int event = M8080_WATCH_END;
+  if(c->cycles >= deadline || c->suspended) {
+    // nothing left to run
+  } else if(c->halted && !c->ready) {
+    // nothing happens until an interrupt, which can't come in the middle of
+    // the slice
+    m8080_run_until(c, deadline);
+    event = M8080_WATCH_HALTED;
+  } else {
+    // a ready CPU takes an interrupt instead of executing anything
+    const bool executes = !c->halted && c->ready != 1;
+    if(executes) w->opcode = m8080_rb(c, c->pc);
+    m8080_run_until(c, c->cycles + 1);
+    event = c->suspended ? M8080_WATCH_SUSPENDED
+      : executes ? M8080_WATCH_INSTRUCTION : M8080_WATCH_INTERRUPT;
+  }
+  c->deadline = deadline;
+  return event;
+}
+
+// 64-bit FNV-1a
+static inline uint64_t m8080_hash(const m8080* const c, const uint16_t a, const size_t size) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for(size_t i = 0; i < size; ++i) hash = (hash ^ m8080_rb(c, a + i)) * 0x100000001b3;
+  return hash;
+}
+
+bool m8080_rom_init(m8080_rom* const r, const m8080* const c, const uint16_t base, const size_t size) {
+  memset(r, 0, sizeof(*r));
+  r->base = base;
+  r->size = size > 0x10000 - base ? 0x10000 - base : size;
+  // plus a zeroed entry past the end, so that the one after any instruction
+  // can be looked at without checking
+  r->code = calloc(r->size + 1, sizeof(m8080_code));
+  r->skip = calloc(r->size, 1);
+  r->failed = calloc(r->size, 1);
+  r->queue = malloc(r->size * sizeof(uint16_t));
+  r->taken = calloc(r->size / M8080_ROM_BLOCK + 1, 1);
+  r->filled = calloc(r->size / M8080_ROM_BLOCK + 1, 1);
+  r->hash = m8080_hash(c, base, r->size);
+  if(r->code && r->skip && r->failed && r->queue && r->taken && r->filled) return true;
+  m8080_rom_free(r);
+  return false;
+}
+
+static void m8080_rom_unmap(m8080_rom* const r);
+
+void m8080_rom_free(m8080_rom* const r) {
+  m8080_rom_unmap(r);
+  free(r->code);
+  free(r->skip);
+  free(r->failed);
+  free(r->queue);
+  free(r->taken);
+  free(r->filled);
+  r->code = NULL;
+  r->skip = NULL;
+  r->failed = NULL;
+  r->queue = NULL;
+  r->taken = NULL;
+  r->filled = NULL;
+}
+
+// copies the instructions starting in the block of index I out of the loaded
+// translation, leaving out any that don't match memory
+static void m8080_rom_take(m8080_rom* const r, const m8080* const c, const uint16_t i) {
+  const size_t block = i / M8080_ROM_BLOCK;
+  if(!r->saved || r->taken[block]) return;
+  r->taken[block] = 1;
+  const size_t end = (block + 1) * M8080_ROM_BLOCK;
+  for(size_t j = block * M8080_ROM_BLOCK; j < end && j < r->size; ++j) {
+    const m8080_code* const code = &r->saved[j];
+    if(!code->size || r->code[j].size) continue;
+    const uint16_t a = r->base + j;
+    bool same = code->size == m8080_size[code->opcode] && j + code->size <= r->size
+      && m8080_rb(c, a) == code->opcode;
+    if(code->size == 2) same &= m8080_rb(c, a + 1) == code->operand;
+    if(code->size == 3) same &= m8080_rw(c, a + 1) == code->operand;
+    for(uint8_t k = 0; same && k < code->size; ++k) same = !r->skip[j + k];
+    if(!same) continue;
+    r->code[j] = *code;
+    r->filled[block] = 1;
+  }
+}
+
+// queues address A to be translated if it is in the ROM and not translated yet
+static inline void m8080_rom_queue(m8080_rom* const r, size_t* const queued, const uint16_t a) {
+  const uint16_t i = a - r->base;
+  if(i < r->size && !r->code[i].size && *queued < r->size) r->queue[(*queued)++] = a;
+}
+
+// true if the instruction of `size` bytes at index I can be translated
+static inline bool m8080_rom_fits(const m8080_rom* const r, const uint16_t i, const uint8_t size) {
+  if(i + size > r->size) return false;
+  for(uint8_t j = 0; j < size; ++j) {
+    if(r->skip[i + j]) return false;
+  }
+  return true;
+}
+
+// follows the code from address A the same way examples/disassembler.c maps
+// it, jumps are followed and the targets of branches, calls and rst queued,
+// it stops at anything already translated, outside the ROM or after which the
+// next address is unknown (ret and pchl)
+size_t m8080_rom_translate(m8080_rom* const r, const m8080* const c, const uint16_t a) {
+  size_t queued = 0;
+  size_t translated = 0;
+  m8080_rom_queue(r, &queued, a);
+  while(queued) {
+    uint16_t pos = r->queue[--queued];
+    for(;;) {
+      const uint16_t i = pos - r->base;
+      if(i >= r->size) break;
+      m8080_rom_take(r, c, i);
+      if(r->code[i].size) break;
+      const uint8_t opcode = m8080_rb(c, pos);
+      const uint8_t size = m8080_size[opcode];
+      if(!m8080_rom_fits(r, i, size)) break;
+      m8080_code* const code = &r->code[i];
+      code->opcode = opcode;
+      code->size = size;
+      if(size == 2) code->operand = m8080_rb(c, pos + 1);
+      if(size == 3) code->operand = m8080_rw(c, pos + 1);
+      r->filled[i / M8080_ROM_BLOCK] = 1;
+      ++translated;
+
+      if(opcode == 0xc3 || opcode == 0xcb) { // jmp
+        pos = code->operand;
+        continue;
+      }
+      if(opcode == 0xc9 || opcode == 0xd9 || opcode == 0xe9) break; // ret, pchl
+      // rst
+      if((opcode & 0xc7) == 0xc7) m8080_rom_queue(r, &queued, opcode & 0x38);
+      // conditional jumps, calls and conditional calls
+      if((opcode & 0xc7) == 0xc2 || (opcode & 0xcf) == 0xcd || (opcode & 0xc7) == 0xc4) {
+        m8080_rom_queue(r, &queued, code->operand);
+      }
+      pos += size;
+    }
+  }
+  return translated;
+}
+
+void m8080_rom_forget(m8080_rom* const r, const uint16_t a) {
+  const uint16_t i = a - r->base;
+  if(i < r->size) r->skip[i] = 1;
+  for(uint16_t j = 0; j < 3; ++j) {
+    const uint16_t k = i - j;
+    if(k < r->size && r->code[k].size > j) r->code[k].size = 0;
+  }
+}
+
+void m8080_rom_invalidate(m8080_rom* const r, const uint16_t a, const size_t size) {
+  // instructions starting up to two bytes before the window reach into it
+  const size_t begin = a < r->base + 2 ? 0 : a - r->base - 2;
+  const size_t end = a + size - r->base < r->size ? a + size - r->base : r->size;
+  if(a + size <= r->base || begin >= end) return;
+  // whatever is mapped now may translate where the old bank didn't
+  memset(&r->failed[begin], 0, end - begin);
+  for(size_t block = begin / M8080_ROM_BLOCK; block * M8080_ROM_BLOCK < end; ++block) {
+    // the loaded translation is checked again against whatever is there now,
+    // even where the old bank left nothing of it to drop
+    r->taken[block] = 0;
+    if(!r->filled[block]) continue;
+    const size_t first = block * M8080_ROM_BLOCK;
+    const size_t from = begin > first ? begin : first;
+    const size_t to = end < first + M8080_ROM_BLOCK ? end : first + M8080_ROM_BLOCK;
+    memset(&r->code[from], 0, (to - from) * sizeof(m8080_code));
+    r->filled[block] = from > first || to < first + M8080_ROM_BLOCK;
+  }
+}
+
+#define M8080_ROM_MAGIC "m8080rom"
+
+// the code entries follow, then the skipped bytes
+typedef struct m8080_rom_header {
+  char magic[8];
+  uint64_t hash;
+  uint64_t size;
+  uint32_t version;
+  uint16_t base;
+  // 0x8080 as written by the host, tells byte orders apart
+  uint16_t order;
+} m8080_rom_header;
+
+static inline m8080_rom_header m8080_rom_header_of(const m8080_rom* const r) {
+  m8080_rom_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, M8080_ROM_MAGIC, 8);
+  h.hash = r->hash;
+  h.size = r->size;
+  h.version = M8080_ROM_VERSION;
+  h.base = r->base;
+  h.order = 0x8080;
+  return h;
+}
+
+bool m8080_rom_save(const m8080_rom* const r, const char* const path) {
+  // written next to the file and renamed over it
+  char* const tmp = malloc(strlen(path) + 5);
+  if(!tmp) return false;
+  strcpy(tmp, path);
+  strcat(tmp, ".tmp");
+  FILE* const f = fopen(tmp, "wb");
+  if(!f) {
+    free(tmp);
+    return false;
+  }
+  const m8080_rom_header h = m8080_rom_header_of(r);
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  // blocks not taken yet are still only in the loaded translation
+  for(size_t i = 0; ok && i < r->size; i += M8080_ROM_BLOCK) {
+    const size_t block = i / M8080_ROM_BLOCK;
+    const m8080_code* const code = r->saved && !r->taken[block] ? r->saved : r->code;
+    const size_t n = r->size - i < M8080_ROM_BLOCK ? r->size - i : M8080_ROM_BLOCK;
+    ok = fwrite(code + i, sizeof(m8080_code), n, f) == n;
+  }
+  ok = ok && fwrite(r->skip, 1, r->size, f) == r->size;
+  ok &= fclose(f) == 0;
+  ok = ok && rename(tmp, path) == 0;
+  if(!ok) remove(tmp);
+  free(tmp);
+  return ok;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// maps the whole file, pages of the same file are shared by every process
+static void* m8080_rom_map_file(const char* const path, size_t* const size) {
+  const int fd = open(path, O_RDONLY);
+  if(fd < 0) return NULL;
+  struct stat st;
+  void* map = NULL;
+  if(fstat(fd, &st) == 0 && st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED) map = NULL;
+    *size = st.st_size;
+  }
+  close(fd);
+  return map;
+}
+
+static void m8080_rom_unmap(m8080_rom* const r) {
+  if(r->map) munmap(r->map, r->map_size);
+  r->map = NULL;
+  r->saved = NULL;
+}
+#else
+// read into memory where there is no `mmap`
+static void* m8080_rom_map_file(const char* const path, size_t* const size) {
+  FILE* const f = fopen(path, "rb");
+  if(!f) return NULL;
+  void* map = NULL;
+  if(fseek(f, 0, SEEK_END) == 0 && ftell(f) > 0) {
+    *size = ftell(f);
+    map = malloc(*size);
+    rewind(f);
+    if(map && fread(map, 1, *size, f) != *size) {
+      free(map);
+      map = NULL;
+    }
+  }
+  fclose(f);
+  return map;
+}
+
+static void m8080_rom_unmap(m8080_rom* const r) {
+  free(r->map);
+  r->map = NULL;
+  r->saved = NULL;
+}
+#endif
+
+bool m8080_rom_load(m8080_rom* const r, const char* const path) {
+  m8080_rom_unmap(r);
+  size_t size = 0;
+  void* const map = m8080_rom_map_file(path, &size);
+  if(!map) return false;
+  r->map = map;
+  r->map_size = size;
+
+  const m8080_rom_header h = m8080_rom_header_of(r);
+  const size_t expected = sizeof(h) + r->size * (sizeof(m8080_code) + 1);
+  if(size != expected || memcmp(map, &h, sizeof(h))) {
+    m8080_rom_unmap(r);
+    return false;
+  }
+  r->saved = (const m8080_code*)((const char*)map + sizeof(h));
+  // the skipped bytes are needed everywhere before anything is translated
+  const uint8_t* const skip = (const uint8_t*)(r->saved + r->size);
+  for(size_t i = 0; i < r->size; ++i) r->skip[i] |= skip[i];
+  memset(r->taken, 0, r->size / M8080_ROM_BLOCK + 1);
+  // what failed may be in the loaded translation
+  memset(r->failed, 0, r->size);
+  return true;
+}
+
+uint64_t m8080_rom_run_until(m8080* const c, m8080_rom* const r, const uint64_t deadline) {
+  return m8080_run_loop(c, r, deadline);
+}
+
+uint64_t m8080_rom_run(m8080* const c, m8080_rom* const r, const uint64_t cycles) {
+  return m8080_rom_run_until(c, r, m8080_next_deadline(c, cycles));
+}
+
 size_t m8080_interrupt(m8080* const c, const uint16_t a) {
-  const size_t previous_cycle = c->cycles;
-  if(c->inte) {
+  const uint64_t previous_cycle = c->cycles;
+  // not in the middle of a suspended instruction
+  if(c->inte && !c->suspended) {
     c->inte = 0;
+    c->ready = 0;
+    if(c->halted) {
+      c->halted = 0;
+      ++c->pc;
+    }
     m8080_call(c, a);
     c->cycles += 11;
   }
   return c->cycles - previous_cycle;
 }
 
+struct m8080_page {
+  // number of `m8080_memory` sharing this page
+#ifndef __STDC_NO_ATOMICS__
+  atomic_size_t refs;
+#else
+  size_t refs;
+#endif
+  uint8_t data[M8080_PAGE_SIZE];
+};
+
+static inline m8080_page* m8080_page_new(void) {
+  m8080_page* const p = calloc(1, sizeof(m8080_page));
+  if(p) p->refs = 1;
+  return p;
+}
+
+static inline void m8080_page_release(m8080_page* const p) {
+#ifndef __STDC_NO_ATOMICS__
+  if(atomic_fetch_sub(&p->refs, 1) == 1) free(p);
+#else
+  if(p->refs-- == 1) free(p);
+#endif
+}
+
+bool m8080_memory_init(m8080_memory* const m) {
+  memset(m, 0, sizeof(*m));
+  for(size_t i = 0; i < M8080_PAGES; ++i) {
+    m->page[i] = m8080_page_new();
+    if(!m->page[i]) {
+      m8080_memory_free(m);
+      return false;
+    }
+    m->read[i] = m->page[i]->data;
+    m->write[i] = m->page[i]->data;
+  }
+  return true;
+}
+
+void m8080_memory_free(m8080_memory* const m) {
+  for(size_t i = 0; i < M8080_PAGES; ++i) {
+    if(m->page[i]) m8080_page_release(m->page[i]);
+  }
+  memset(m, 0, sizeof(*m));
+}
+
+void m8080_memory_fork(m8080_memory* const dst, m8080_memory* const src) {
+  *dst = *src;
+  for(size_t i = 0; i < M8080_PAGES; ++i) {
+#ifndef __STDC_NO_ATOMICS__
+    atomic_fetch_add(&src->page[i]->refs, 1);
+#else
+    ++src->page[i]->refs;
+#endif
+    // the next write to this page on either side goes through
+    // `m8080_memory_fault` which makes a private copy, banks stay shared
+    if(src->bank[i]) continue;
+    src->write[i] = NULL;
+    dst->write[i] = NULL;
+  }
+}
+
+// gives `m` a private copy of page N if it is shared, returns false if out of
+// memory
+static inline bool m8080_memory_unshare(m8080_memory* const m, const size_t n) {
+  m8080_page* const p = m->page[n];
+  // nobody else can take a reference to a page we hold alone without going
+  // through `m8080_memory_fork` on this same memory
+  if(p->refs != 1) {
+    m8080_page* const copy = m8080_page_new();
+    if(!copy) return false;
+    memcpy(copy->data, p->data, M8080_PAGE_SIZE);
+    m8080_page_release(p);
+    m->page[n] = copy;
+    m->read[n] = copy->data;
+  }
+  m->write[n] = m->page[n]->data;
+  return true;
+}
+
+bool m8080_memory_load(m8080_memory* const m, const uint16_t a,
+    const void* const data, const size_t size) {
+  const uint8_t* const bytes = data;
+  for(size_t i = 0; i < size && a + i < 0x10000; ++i) {
+    const size_t n = (a + i) >> M8080_PAGE_BITS;
+    if(m->bank[n]) {
+      m->bank[n][(a + i) & M8080_PAGE_MASK] = bytes[i];
+      continue;
+    }
+    if(!m->write[n] && !m8080_memory_unshare(m, n)) return false;
+    m->write[n][(a + i) & M8080_PAGE_MASK] = bytes[i];
+  }
+  // read-only pages never keep a write pointer
+  for(size_t i = 0; i < M8080_PAGES; ++i) {
+    if(m->rom >> i & 0x01 && !m->bank[i]) m->write[i] = NULL;
+  }
+  return true;
+}
+
+void m8080_memory_protect(m8080_memory* const m, const uint16_t a, const size_t size) {
+  if(size == 0) return;
+  const size_t last = (a + size - 1 < 0x10000 ? a + size - 1 : 0xffff) >> M8080_PAGE_BITS;
+  for(size_t i = a >> M8080_PAGE_BITS; i <= last; ++i) {
+    m->rom |= (uint32_t)1 << i;
+    if(!m->bank[i]) m->write[i] = NULL;
+  }
+}
+
+void m8080_memory_map(m8080_memory* const m, const uint16_t a, const size_t size,
+    void* const data, const bool rom) {
+  uint8_t* const bytes = data;
+  for(size_t i = 0; i < size >> M8080_PAGE_BITS && (a >> M8080_PAGE_BITS) + i < M8080_PAGES; ++i) {
+    const size_t n = (a >> M8080_PAGE_BITS) + i;
+    m->bank[n] = bytes + (i << M8080_PAGE_BITS);
+    m->read[n] = m->bank[n];
+    m->write[n] = rom ? NULL : m->bank[n];
+  }
+}
+
+void m8080_memory_unmap(m8080_memory* const m, const uint16_t a, const size_t size) {
+  for(size_t i = 0; i < size >> M8080_PAGE_BITS && (a >> M8080_PAGE_BITS) + i < M8080_PAGES; ++i) {
+    const size_t n = (a >> M8080_PAGE_BITS) + i;
+    m->bank[n] = NULL;
+    m->read[n] = m->page[n]->data;
+    // the first write finds out if the page is still shared
+    m->write[n] = NULL;
+  }
+}
+
+static uint8_t m8080_memory_callback_rb(const m8080* const c, const uint16_t a) {
+  return m8080_memory_rb(c->userdata, a);
+}
+
+static void m8080_memory_callback_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  m8080_memory_wb(c->userdata, a, b);
+}
+
+const m8080_callbacks m8080_memory_callbacks = {
+  .rb = m8080_memory_callback_rb,
+  .wb = m8080_memory_callback_wb,
+};
+
+void m8080_memory_fault(m8080_memory* const m, const uint16_t a, const uint8_t b) {
+  const size_t n = a >> M8080_PAGE_BITS;
+  // writes to ROM are ignored, and the only banks without a write pointer are
+  // read-only
+  if(m->bank[n] || m->rom >> n & 0x01) return;
+  // there is no way to report running out of memory from inside an
+  // instruction, the write is dropped
+  if(!m8080_memory_unshare(m, n)) return;
+  m->write[n][a & M8080_PAGE_MASK] = b;
+}
+
 #endif // M8080_IMPLEMENTATION
 
 /*
@@ -0,0 +1,721 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#ifndef M8080_CPM_H
+#define M8080_CPM_H
+// CP/M 2.2 environment for `m8080`, runs .COM programs with the BDOS and BIOS
+// emulated on the host: the console is a pair of `FILE*` and drive A is a host
+// directory (POSIX only)
+//
+// the user must define M8080_CPM_IMPLEMENTATION in exactly one file that
+// includes this header before the include, just like `m8080.h`:
+//
+//      #define M8080_CPM_IMPLEMENTATION
+//      #include "m8080_cpm.h"
+//
+// a CP/M machine owns its memory and is the `userdata` of its CPU:
+//
+//      static m8080_cpm cpm;
+//      m8080 c;
+//      m8080_cpm_init(&cpm, &c);
+//      m8080_cpm_load(&cpm, "prog.com");
+//      m8080_cpm_args(&cpm, "file.txt");
+//      while(!cpm.done) m8080_step(&c);
+//      m8080_cpm_free(&cpm);
+//
+// once done the CPU is halted, `m8080_run` would count the rest of its slice
+// as hlt instructions
+//
+// the BDOS and BIOS entry points are traps (see `m8080_is_trap`), so nothing
+// is checked while the program runs, and a trapped call costs as many cycles
+// as a bare ret
+//
+// files are read and written straight from and to the DMA buffer in emulated
+// memory through large `FILE*` buffers, sequential access doesn't seek
+//
+// console output is collected in the machine and only handed to `out` when
+// the buffer fills up, before reading console input, when the program exits
+// and on `m8080_cpm_flush`, so machines running in parallel don't take the
+// stdio lock for every character, it can also be captured in memory:
+//
+//      cpm.out = NULL; // only capture
+//      cpm.capture = true;
+//      while(!cpm.done) m8080_step(&c);
+//      compare(cpm.log, cpm.log_size);
+//      m8080_cpm_free(&cpm);
+
+#include "m8080.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// files that can be open at the same time
+#define M8080_CPM_FILES 16
+// size of the host buffer of every open file
+#define M8080_CPM_BUFFER 0x10000
+// size of the console output buffer
+#define M8080_CPM_CONSOLE 0x2000
+// drives that can be selected, only A
+#define M8080_CPM_DRIVES 1
+
+// memory layout, the BDOS entry point is the top of the transient program area
+#define M8080_CPM_BDOS 0xfe06
+#define M8080_CPM_BIOS 0xff00
+// a hlt the CPU is sent to when the program exits
+#define M8080_CPM_EXIT (M8080_CPM_BIOS + 17 * 3)
+
+typedef struct m8080_cpm {
+  uint8_t memory[0x10000];
+  FILE* in; // console input, stdin by default
+  FILE* out; // console output, stdout by default, NULL discards it
+  bool line; // flush the console output at every new line, for watching it
+  // console output that wasn't written to `out` yet
+  uint8_t console[M8080_CPM_CONSOLE];
+  size_t pending;
+  // when set all console output is also appended to `log`, which grows as
+  // needed, is always zero terminated and is released by `m8080_cpm_free`,
+  // `capture` is cleared if it can't grow
+  bool capture;
+  char* log;
+  size_t log_size;
+  size_t log_capacity;
+  const char* dir; // host directory of drive A, the current directory by default
+  uint16_t dma; // address of the 128-byte record buffer
+  uint8_t drive; // current drive, only A exists
+  uint8_t user; // current user number, ignored
+  bool done; // the program called function 0 or warm booted
+  // open files, the FCB of an open file holds the index in its allocation map
+  FILE* file[M8080_CPM_FILES];
+  // host position of each file in records, to avoid seeking
+  uint32_t position[M8080_CPM_FILES];
+  // whether the last transfer was a write, switching needs a seek
+  bool writing[M8080_CPM_FILES];
+  // state of search first/search next
+  void* search;
+  uint8_t pattern[11];
+} m8080_cpm;
+
+// fills the zero page, the BDOS and the BIOS and points `c` at the machine,
+// the program starts at 0x0100 with a stack that returns to the warm boot
+void m8080_cpm_init(m8080_cpm* const cpm, m8080* const c);
+// loads a .COM file at 0x0100, returns false if it can't be read, is empty or
+// doesn't fit below the BDOS
+bool m8080_cpm_load(m8080_cpm* const cpm, const char* const path);
+// sets the command tail at 0x0080 and the default FCBs at 0x005c and 0x006c
+// from the first two words of `tail`, like the CCP would
+void m8080_cpm_args(m8080_cpm* const cpm, const char* const tail);
+// closes every file, flushes the console and releases the captured output
+void m8080_cpm_free(m8080_cpm* const cpm);
+// writes the pending console output to `out` and flushes it
+void m8080_cpm_flush(m8080_cpm* const cpm);
+
+// `userdata` must be the `m8080_cpm`
+extern const m8080_callbacks m8080_cpm_callbacks;
+void m8080_cpm_trap(m8080* const c, const uint8_t opcode);
+
+#endif // M8080_CPM_H
+
+#ifdef M8080_CPM_IMPLEMENTATION
+#undef M8080_CPM_IMPLEMENTATION
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// any of the undocumented nops works, see `m8080_is_trap`
+#define M8080_CPM_TRAP 0x08
+
+static uint8_t m8080_cpm_rb(const m8080* const c, const uint16_t a) {
+  const m8080_cpm* const cpm = c->userdata;
+  return cpm->memory[a];
+}
+
+static void m8080_cpm_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  m8080_cpm* const cpm = c->userdata;
+  cpm->memory[a] = b;
+}
+
+const m8080_callbacks m8080_cpm_callbacks = {
+  .rb = m8080_cpm_rb,
+  .wb = m8080_cpm_wb,
+  .trap = m8080_cpm_trap,
+};
+
+void m8080_cpm_init(m8080_cpm* const cpm, m8080* const c) {
+  memset(cpm, 0, sizeof(*cpm));
+  cpm->in = stdin;
+  cpm->out = stdout;
+  cpm->dir = ".";
+  cpm->dma = 0x0080;
+
+  uint8_t* const m = cpm->memory;
+  // the zero page would have a jmp to the warm boot at 0x0000 and a jmp to the
+  // BDOS at 0x0005, programs only ever look at the addresses so the traps take
+  // the place of the jmp opcodes
+  m[0x0000] = M8080_CPM_TRAP;
+  m[0x0001] = (M8080_CPM_BIOS + 3) & 0xff;
+  m[0x0002] = (M8080_CPM_BIOS + 3) >> 8;
+  m[0x0005] = M8080_CPM_TRAP;
+  m[0x0006] = M8080_CPM_BDOS & 0xff;
+  m[0x0007] = M8080_CPM_BDOS >> 8;
+  m[M8080_CPM_BDOS] = M8080_CPM_TRAP;
+  // every entry of the BIOS jump table is a trap
+  for(size_t i = 0; i < 17; ++i) m[M8080_CPM_BIOS + i * 3] = M8080_CPM_TRAP;
+  m[M8080_CPM_EXIT] = 0x76; // hlt
+
+  memset(c, 0, sizeof(*c));
+  c->userdata = cpm;
+  c->cb = &m8080_cpm_callbacks;
+  c->pc = 0x0100;
+  // returning from the program warm boots, the return address is 0x0000
+  c->sp = M8080_CPM_BDOS - 6;
+}
+
+bool m8080_cpm_load(m8080_cpm* const cpm, const char* const path) {
+  FILE* const f = fopen(path, "rb");
+  if(!f) return false;
+  const size_t size = fread(cpm->memory + 0x0100, 1, M8080_CPM_BDOS - 6 - 0x0100, f);
+  // anything left over would overwrite the stack and the BDOS
+  const bool loaded = size > 0 && !ferror(f) && fgetc(f) == EOF && !ferror(f);
+  fclose(f);
+  return loaded;
+}
+
+// parses a file name into the name and type of a FCB, `*` fills the rest of
+// the name or type with `?`, returns the first character after it
+static const char* m8080_cpm_parse(uint8_t* const fcb, const char* s) {
+  memset(fcb, 0, 36);
+  memset(fcb + 1, ' ', 11);
+  while(*s == ' ') ++s;
+  if(s[0] && s[1] == ':') {
+    fcb[0] = toupper((unsigned char)s[0]) - 'A' + 1;
+    s += 2;
+  }
+  for(size_t i = 0, end = 8; *s && *s != ' '; ++s) {
+    if(*s == '.') {
+      i = 8;
+      end = 11;
+    } else if(*s == '*') {
+      while(i < end) fcb[1 + i++] = '?';
+    } else if(i < end) {
+      fcb[1 + i++] = toupper((unsigned char)*s);
+    }
+  }
+  return s;
+}
+
+void m8080_cpm_args(m8080_cpm* const cpm, const char* const tail) {
+  uint8_t* const m = cpm->memory;
+  size_t len = strlen(tail);
+  if(len > 125) len = 125;
+  // the CCP converts the command line to upper case and starts it with a space
+  m[0x0080] = len + 1;
+  m[0x0081] = ' ';
+  for(size_t i = 0; i < len; ++i) m[0x0082 + i] = toupper((unsigned char)tail[i]);
+  m[0x0082 + len] = 0;
+
+  uint8_t second[36];
+  m8080_cpm_parse(second, m8080_cpm_parse(m + 0x005c, tail));
+  // the second FCB overlaps the first one, only its first 16 bytes are valid
+  memcpy(m + 0x006c, second, 16);
+}
+
+void m8080_cpm_free(m8080_cpm* const cpm) {
+  for(size_t i = 0; i < M8080_CPM_FILES; ++i) {
+    if(cpm->file[i]) fclose(cpm->file[i]);
+    cpm->file[i] = NULL;
+  }
+  if(cpm->search) closedir(cpm->search);
+  cpm->search = NULL;
+  m8080_cpm_flush(cpm);
+  free(cpm->log);
+  cpm->log = NULL;
+  cpm->log_size = 0;
+  cpm->log_capacity = 0;
+}
+
+void m8080_cpm_flush(m8080_cpm* const cpm) {
+  if(!cpm->out) return;
+  fwrite(cpm->console, 1, cpm->pending, cpm->out);
+  fflush(cpm->out);
+  cpm->pending = 0;
+}
+
+static void m8080_cpm_capture(m8080_cpm* const cpm, const uint8_t* const s, const size_t n) {
+  if(cpm->log_size + n + 1 > cpm->log_capacity) {
+    size_t capacity = cpm->log_capacity ? cpm->log_capacity : M8080_CPM_CONSOLE;
+    while(cpm->log_size + n + 1 > capacity) capacity *= 2;
+    char* const log = realloc(cpm->log, capacity);
+    if(!log) {
+      cpm->capture = false;
+      return;
+    }
+    cpm->log = log;
+    cpm->log_capacity = capacity;
+  }
+  memcpy(cpm->log + cpm->log_size, s, n);
+  cpm->log_size += n;
+  cpm->log[cpm->log_size] = '\0';
+}
+
+static void m8080_cpm_write(m8080_cpm* const cpm, const uint8_t* const s, const size_t n) {
+  if(cpm->capture) m8080_cpm_capture(cpm, s, n);
+  if(!cpm->out) return;
+
+  if(cpm->pending + n > M8080_CPM_CONSOLE) {
+    fwrite(cpm->console, 1, cpm->pending, cpm->out);
+    cpm->pending = 0;
+    // not worth copying twice
+    if(n >= M8080_CPM_CONSOLE) {
+      fwrite(s, 1, n, cpm->out);
+      return;
+    }
+  }
+  memcpy(cpm->console + cpm->pending, s, n);
+  cpm->pending += n;
+  if(cpm->line && memchr(s, '\n', n)) m8080_cpm_flush(cpm);
+}
+
+static inline void m8080_cpm_putc(m8080_cpm* const cpm, const uint8_t ch) {
+  m8080_cpm_write(cpm, &ch, 1);
+}
+
+// prompts are not terminated by a new line, so the console output is flushed
+// before waiting for input
+static inline int m8080_cpm_getc(m8080_cpm* const cpm) {
+  m8080_cpm_flush(cpm);
+  return getc(cpm->in);
+}
+
+// prints the string at `a` up to the `$`, which may be past the top of memory
+static void m8080_cpm_print(m8080_cpm* const cpm, const uint16_t a) {
+  const uint8_t* const s = cpm->memory + a;
+  const uint8_t* end = memchr(s, '$', 0x10000 - a);
+  if(end) {
+    m8080_cpm_write(cpm, s, end - s);
+    return;
+  }
+  m8080_cpm_write(cpm, s, 0x10000 - a);
+  // a string without a `$` is printed once rather than forever
+  end = memchr(cpm->memory, '$', a);
+  m8080_cpm_write(cpm, cpm->memory, end ? (size_t)(end - cpm->memory) : a);
+}
+
+// characters CP/M allows in file names, which also keeps paths inside `dir`
+static inline bool m8080_cpm_valid(const char ch) {
+  return ch > ' ' && ch < 0x7f && !strchr("<>.,;:=?*[]/\\", ch);
+}
+
+// host path of the file named in a FCB, lower case and without padding,
+// returns false if the name is blank or has characters CP/M doesn't allow
+static bool m8080_cpm_path(const m8080_cpm* const cpm, const uint8_t* const fcb,
+    char* const path, const size_t size) {
+  char name[13];
+  size_t n = 0;
+  for(size_t i = 0; i < 11; ++i) {
+    if(i == 8) {
+      if(!n) return false;
+      name[n++] = '.';
+    }
+    const char ch = fcb[1 + i] & 0x7f; // the high bits of the type are attributes
+    if(ch == ' ') continue;
+    if(!m8080_cpm_valid(ch)) return false;
+    name[n++] = tolower((unsigned char)ch);
+  }
+  if(name[n - 1] == '.') --n;
+  name[n] = 0;
+  snprintf(path, size, "%s/%s", cpm->dir, name);
+  return true;
+}
+
+// open file of a FCB, its index is kept in the first byte of the allocation map
+static inline FILE* m8080_cpm_file(const m8080_cpm* const cpm, const uint8_t* const fcb) {
+  const uint8_t i = fcb[16];
+  return i > 0 && i <= M8080_CPM_FILES ? cpm->file[i - 1] : NULL;
+}
+
+static uint8_t m8080_cpm_open(m8080_cpm* const cpm, uint8_t* const fcb, const char* const mode) {
+  char path[4096];
+  if(!m8080_cpm_path(cpm, fcb, path, sizeof(path))) return 0xff;
+
+  size_t i = 0;
+  while(i < M8080_CPM_FILES && cpm->file[i]) ++i;
+  if(i == M8080_CPM_FILES) return 0xff;
+
+  FILE* f = fopen(path, mode);
+  // read-only files can still be opened
+  if(!f && mode[0] == 'r') f = fopen(path, "rb");
+  if(!f) return 0xff;
+  setvbuf(f, NULL, _IOFBF, M8080_CPM_BUFFER);
+
+  fseek(f, 0, SEEK_END);
+  const uint32_t records = (ftell(f) + 127) / 128;
+  fseek(f, 0, SEEK_SET);
+
+  cpm->file[i] = f;
+  cpm->position[i] = 0;
+  memset(fcb + 16, 0, 16);
+  fcb[16] = i + 1;
+  // records in the current extent
+  const uint32_t extent = (fcb[14] * 32 + fcb[12]) * 128;
+  fcb[15] = records <= extent ? 0 : records - extent > 128 ? 128 : records - extent;
+  return 0x00;
+}
+
+static uint8_t m8080_cpm_close(m8080_cpm* const cpm, uint8_t* const fcb) {
+  FILE* const f = m8080_cpm_file(cpm, fcb);
+  if(!f) return 0xff;
+  fclose(f);
+  cpm->file[fcb[16] - 1] = NULL;
+  fcb[16] = 0;
+  return 0x00;
+}
+
+// record number of sequential access
+static inline uint32_t m8080_cpm_record(const uint8_t* const fcb) {
+  return ((fcb[14] & 0x3f) * 32 + (fcb[12] & 0x1f)) * 128 + (fcb[32] & 0x7f);
+}
+
+static inline void m8080_cpm_set_record(uint8_t* const fcb, const uint32_t record) {
+  fcb[32] = record & 0x7f;
+  fcb[12] = record >> 7 & 0x1f;
+  fcb[14] = record >> 12 & 0x3f;
+}
+
+// reads or writes one record at the DMA address, the file buffer is copied to
+// and from emulated memory directly unless the record wraps around
+static uint8_t m8080_cpm_transfer(m8080_cpm* const cpm, uint8_t* const fcb,
+    const uint32_t record, const bool write) {
+  FILE* const f = m8080_cpm_file(cpm, fcb);
+  if(!f) return 0x09; // invalid FCB
+  const size_t i = fcb[16] - 1;
+
+  if(cpm->position[i] != record || cpm->writing[i] != write) {
+    if(fseek(f, (long)record * 128, SEEK_SET)) return 0x06; // seek past end
+    cpm->position[i] = record;
+    cpm->writing[i] = write;
+  }
+
+  uint8_t tmp[128];
+  const bool wraps = cpm->dma > 0x10000 - 128;
+  uint8_t* const buffer = wraps ? tmp : cpm->memory + cpm->dma;
+
+  if(write) {
+    if(wraps) {
+      for(size_t j = 0; j < 128; ++j) tmp[j] = cpm->memory[(cpm->dma + j) & 0xffff];
+    }
+    if(fwrite(buffer, 1, 128, f) != 128) return 0x02; // disk full
+  } else {
+    const size_t n = fread(buffer, 1, 128, f);
+    if(n == 0) {
+      // the position is unknown after a failed read
+      cpm->position[i] = UINT32_MAX;
+      return 0x01; // end of file
+    }
+    memset(buffer + n, 0x1a, 128 - n); // ^Z pads the last record of text files
+    if(wraps) {
+      for(size_t j = 0; j < 128; ++j) cpm->memory[(cpm->dma + j) & 0xffff] = tmp[j];
+    }
+  }
+  ++cpm->position[i];
+  return 0x00;
+}
+
+static uint8_t m8080_cpm_sequential(m8080_cpm* const cpm, uint8_t* const fcb, const bool write) {
+  const uint32_t record = m8080_cpm_record(fcb);
+  const uint8_t ret = m8080_cpm_transfer(cpm, fcb, record, write);
+  if(ret == 0x00) m8080_cpm_set_record(fcb, record + 1);
+  return ret;
+}
+
+static uint8_t m8080_cpm_random(m8080_cpm* const cpm, uint8_t* const fcb, const bool write) {
+  const uint32_t record = fcb[33] | fcb[34] << 8 | (fcb[35] & 0x03) << 16;
+  // random access sets the sequential position to the record, but does not
+  // advance it
+  m8080_cpm_set_record(fcb, record);
+  return m8080_cpm_transfer(cpm, fcb, record, write);
+}
+
+static inline bool m8080_cpm_match(const uint8_t* const pattern, const uint8_t* const name) {
+  for(size_t i = 0; i < 11; ++i) {
+    if(pattern[i] != '?' && (pattern[i] & 0x7f) != name[i]) return false;
+  }
+  return true;
+}
+
+// writes the next directory entry matching the search pattern to the DMA
+// buffer, only host files with valid 8.3 names are visible
+static uint8_t m8080_cpm_search(m8080_cpm* const cpm) {
+  if(!cpm->search) return 0xff;
+  struct dirent* entry;
+  while((entry = readdir(cpm->search))) {
+    uint8_t fcb[36];
+    m8080_cpm_parse(fcb, entry->d_name);
+    char path[4096];
+    // names that don't survive the round trip don't fit in 8.3
+    if(!m8080_cpm_path(cpm, fcb, path, sizeof(path))
+        || strcasecmp(path + strlen(cpm->dir) + 1, entry->d_name)) {
+      continue;
+    }
+    if(!m8080_cpm_match(cpm->pattern, fcb + 1)) continue;
+
+    FILE* const f = fopen(path, "rb");
+    if(!f) continue;
+    fseek(f, 0, SEEK_END);
+    const uint32_t records = (ftell(f) + 127) / 128;
+    fclose(f);
+
+    // the entry is the first one of the record, so A is always 0
+    uint8_t* const dir = cpm->memory + (cpm->dma <= 0x10000 - 32 ? cpm->dma : 0x0080);
+    memset(dir, 0, 32);
+    dir[0] = cpm->user;
+    memcpy(dir + 1, fcb + 1, 11);
+    dir[15] = records > 128 ? 128 : records;
+    return 0x00;
+  }
+  closedir(cpm->search);
+  cpm->search = NULL;
+  return 0xff;
+}
+
+static uint8_t m8080_cpm_delete(m8080_cpm* const cpm, const uint8_t* const fcb) {
+  memcpy(cpm->pattern, fcb + 1, 11);
+  if(cpm->search) closedir(cpm->search);
+  cpm->search = opendir(cpm->dir);
+  // the DMA buffer is used to list the matches, as it would by the BDOS
+  uint8_t ret = 0xff;
+  while(m8080_cpm_search(cpm) == 0x00) {
+    char path[4096];
+    const bool valid = m8080_cpm_path(cpm,
+        cpm->memory + (cpm->dma <= 0x10000 - 32 ? cpm->dma : 0x0080), path, sizeof(path));
+    if(valid && remove(path) == 0) ret = 0x00;
+  }
+  return ret;
+}
+
+static uint8_t m8080_cpm_rename(m8080_cpm* const cpm, const uint8_t* const fcb) {
+  char from[4096], to[4096];
+  if(!m8080_cpm_path(cpm, fcb, from, sizeof(from))
+      || !m8080_cpm_path(cpm, fcb + 16, to, sizeof(to))) {
+    return 0xff;
+  }
+  return rename(from, to) == 0 ? 0x00 : 0xff;
+}
+
+static uint16_t m8080_cpm_size(m8080_cpm* const cpm, uint8_t* const fcb) {
+  char path[4096];
+  if(!m8080_cpm_path(cpm, fcb, path, sizeof(path))) return 0xff;
+  FILE* const f = fopen(path, "rb");
+  if(!f) return 0xff;
+  fseek(f, 0, SEEK_END);
+  const uint32_t records = (ftell(f) + 127) / 128;
+  fclose(f);
+  fcb[33] = records;
+  fcb[34] = records >> 8;
+  fcb[35] = records >> 16;
+  return 0x00;
+}
+
+// reads a line into the buffer at `a`, the first byte is the maximum length
+// and the second is set to the length read
+static void m8080_cpm_read_line(m8080_cpm* const cpm, const uint16_t a) {
+  const uint8_t max = cpm->memory[a];
+  uint8_t n = 0;
+  int ch;
+  while(n < max && (ch = m8080_cpm_getc(cpm)) != EOF && ch != '\n') {
+    if(ch == '\r') continue;
+    cpm->memory[(a + 2 + n++) & 0xffff] = ch;
+  }
+  cpm->memory[(a + 1) & 0xffff] = n;
+}
+
+// BDOS function C with parameter DE, the result is returned in A and L with B
+// and H zeroed for byte results and in HL and BA for word results
+static uint16_t m8080_cpm_bdos(m8080_cpm* const cpm, m8080* const c) {
+  uint8_t* const fcb = cpm->memory + c->de;
+  // FCBs are 36 bytes, one that would wrap around is not valid
+  const bool valid = c->de <= 0x10000 - 36;
+
+  switch(c->c) {
+  case 0: // system reset
+    cpm->done = true;
+    return 0x0000;
+  case 1: { // console input
+    int ch = m8080_cpm_getc(cpm);
+    if(ch == EOF) ch = 0x1a;
+    if(ch == '\n') ch = '\r';
+    m8080_cpm_putc(cpm, ch);
+    return ch;
+  }
+  case 2: // console output
+    m8080_cpm_putc(cpm, c->e);
+    return 0x0000;
+  case 3: // reader input
+    return 0x1a;
+  case 4: // punch output
+  case 5: // list output
+    return 0x0000;
+  case 6: // direct console I/O
+    if(c->e == 0xff) {
+      const int ch = m8080_cpm_getc(cpm);
+      return ch == EOF ? 0x00 : ch == '\n' ? '\r' : ch;
+    }
+    if(c->e != 0xfe) m8080_cpm_putc(cpm, c->e);
+    return 0x0000;
+  case 7: // get I/O byte
+  case 8: // set I/O byte
+    return 0x0000;
+  case 9: // print string
+    m8080_cpm_print(cpm, c->de);
+    return 0x0000;
+  case 10: // read console buffer
+    m8080_cpm_read_line(cpm, c->de);
+    return 0x0000;
+  case 11: // get console status, nothing is ever waiting
+    return 0x0000;
+  case 12: // return version number, CP/M 2.2
+    return 0x0022;
+  case 13: // reset disk system
+    cpm->dma = 0x0080;
+    cpm->drive = 0;
+    return 0x0000;
+  case 14: // select disk, the current drive stays selected if E isn't one
+    if(c->e >= M8080_CPM_DRIVES) return 0xff;
+    cpm->drive = c->e;
+    return 0x00;
+  case 15: // open file
+    return valid ? m8080_cpm_open(cpm, fcb, "r+b") : 0xff;
+  case 16: // close file
+    return valid ? m8080_cpm_close(cpm, fcb) : 0xff;
+  case 17: // search for first
+    if(!valid) return 0xff;
+    memcpy(cpm->pattern, fcb + 1, 11);
+    if(fcb[0] == '?') memset(cpm->pattern, '?', 11);
+    if(cpm->search) closedir(cpm->search);
+    cpm->search = opendir(cpm->dir);
+    return m8080_cpm_search(cpm);
+  case 18: // search for next
+    return m8080_cpm_search(cpm);
+  case 19: // delete file
+    return valid ? m8080_cpm_delete(cpm, fcb) : 0xff;
+  case 20: // read sequential
+    return valid ? m8080_cpm_sequential(cpm, fcb, false) : 0x09;
+  case 21: // write sequential
+    return valid ? m8080_cpm_sequential(cpm, fcb, true) : 0x09;
+  case 22: // make file
+    return valid ? m8080_cpm_open(cpm, fcb, "w+b") : 0xff;
+  case 23: // rename file
+    return valid ? m8080_cpm_rename(cpm, fcb) : 0xff;
+  case 24: // return login vector
+    return (1 << M8080_CPM_DRIVES) - 1;
+  case 25: // return current disk
+    return cpm->drive;
+  case 26: // set DMA address
+    cpm->dma = c->de;
+    return 0x0000;
+  case 32: // set/get user code
+    if(c->e == 0xff) return cpm->user;
+    cpm->user = c->e & 0x0f;
+    return 0x0000;
+  case 33: // read random
+    return valid ? m8080_cpm_random(cpm, fcb, false) : 0x09;
+  case 34: // write random
+  case 40: // write random with zero fill
+    return valid ? m8080_cpm_random(cpm, fcb, true) : 0x09;
+  case 35: // compute file size
+    return valid ? m8080_cpm_size(cpm, fcb) : 0xff;
+  case 36: { // set random record
+    if(!valid) return 0x0000;
+    const uint32_t record = m8080_cpm_record(fcb);
+    fcb[33] = record;
+    fcb[34] = record >> 8;
+    fcb[35] = record >> 16;
+    return 0x0000;
+  }
+  default:
+    return 0x0000;
+  }
+}
+
+// BIOS function N of the jump table, only the character devices exist
+static uint8_t m8080_cpm_bios(m8080_cpm* const cpm, m8080* const c, const size_t n) {
+  switch(n) {
+  case 0: // cold boot
+  case 1: // warm boot
+    cpm->done = true;
+    return 0x00;
+  case 2: // console status
+    return 0x00;
+  case 3: { // console input
+    const int ch = m8080_cpm_getc(cpm);
+    return ch == EOF ? 0x1a : ch == '\n' ? '\r' : ch;
+  }
+  case 4: // console output
+    m8080_cpm_putc(cpm, c->c);
+    return 0x00;
+  case 7: // reader input
+    return 0x1a;
+  case 15: // list status
+    return 0xff;
+  default: // disk functions fail
+    return 0x01;
+  }
+}
+
+void m8080_cpm_trap(m8080* const c, const uint8_t opcode) {
+  m8080_cpm* const cpm = c->userdata;
+  const uint16_t at = c->pc - 1;
+
+  if(at == 0x0005 || at == M8080_CPM_BDOS) {
+    const uint16_t ret = m8080_cpm_bdos(cpm, c);
+    c->hl = ret;
+    c->a = ret;
+    c->b = ret >> 8;
+  } else if(at >= M8080_CPM_BIOS && at < M8080_CPM_EXIT && (at - M8080_CPM_BIOS) % 3 == 0) {
+    c->a = m8080_cpm_bios(cpm, c, (at - M8080_CPM_BIOS) / 3);
+  } else if(at == 0x0000) {
+    // jmp 0000
+    cpm->done = true;
+  } else {
+    // not one of ours, it was a nop after all
+    c->cycles += 4;
+    return;
+  }
+
+  if(cpm->done) {
+    m8080_cpm_flush(cpm);
+    c->pc = M8080_CPM_EXIT;
+    return;
+  }
+  // return from the call, which costs as much as a ret
+  c->pc = cpm->memory[c->sp] | cpm->memory[(c->sp + 1) & 0xffff] << 8;
+  c->sp += 2;
+  c->cycles += 10;
+}
+
+#endif // M8080_CPM_IMPLEMENTATION
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
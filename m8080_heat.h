@@ -0,0 +1,251 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#ifndef M8080_HEAT_H
+#define M8080_HEAT_H
+// memory heatmaps for `m8080`, counts the reads, writes and instruction
+// fetches of every address (or every block of addresses) and where the stack
+// pointer spends its time, and exports them as CSV or as PGM images
+//
+// the user must define M8080_HEAT_IMPLEMENTATION in exactly one file that
+// includes this header before the include, just like `m8080.h`:
+//
+//      #define M8080_HEAT_IMPLEMENTATION
+//      #include "m8080_heat.h"
+//
+// a measured machine runs its slices through the heatmap instead of directly:
+//
+//      m8080_heat h;
+//      m8080_heat_open(&h, c, 0); // per address, 8 for 256-byte pages
+//      for(int frame = 0; frame < 3600; ++frame) m8080_heat_run(&h, c, M8080_HZ / 60);
+//      m8080_heat_save(&h, "heat"); // heat.csv, heat-fetch.pgm, ...
+//      m8080_heat_close(&h, c);
+//
+// memory accesses are seen by wrapping `c->cb->rb` and `c->cb->wb`, with
+// M8080_EXTERN_CALLBACKS `m8080_rb` and `m8080_wb` must call `m8080_heat_read`
+// and `m8080_heat_write` themselves
+//
+// slices run one instruction at a time (see `m8080_watch_next`) so that the
+// bytes of each instruction are counted as fetches and not as reads, a
+// measured machine still runs far faster than the original hardware
+
+#include "m8080.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  M8080_HEAT_READ,
+  M8080_HEAT_WRITE,
+  M8080_HEAT_FETCH, // every byte of every instruction executed
+  M8080_HEAT_STACK, // instructions executed with the stack pointer there
+  M8080_HEAT_KINDS,
+};
+
+typedef struct m8080_heat {
+  // the callbacks of the measured machine, with `rb` and `wb` wrapped, must be
+  // first
+  m8080_callbacks cb;
+  const m8080_callbacks* user; // the callbacks being wrapped
+  // addresses are counted in blocks of 1 << `shift` bytes
+  unsigned shift;
+  uint64_t* count[M8080_HEAT_KINDS];
+  // lowest and highest the stack pointer went
+  uint16_t sp_min, sp_max;
+  uint64_t instructions;
+} m8080_heat;
+
+// starts counting the accesses of `c`, returns false if out of memory
+bool m8080_heat_open(m8080_heat* const h, m8080* const c, const unsigned shift);
+// gives `c` its callbacks back
+void m8080_heat_close(m8080_heat* const h, m8080* const c);
+// `m8080_run_until` and `m8080_run` with the accesses counted
+uint64_t m8080_heat_run_until(m8080_heat* const h, m8080* const c, const uint64_t deadline);
+uint64_t m8080_heat_run(m8080_heat* const h, m8080* const c, const uint64_t cycles);
+// count an access, called by the wrapped callbacks
+void m8080_heat_read(m8080_heat* const h, const uint16_t a);
+void m8080_heat_write(m8080_heat* const h, const uint16_t a);
+// one line per block that was accessed at all: address, reads, writes,
+// fetches and stack, returns false if the file can't be written
+bool m8080_heat_csv(const m8080_heat* const h, const char* const path);
+// a 256x256 image of one kind of access, address 0x0000 on the top left and
+// one row per 256 bytes, one shade per doubling of the count from black
+// (never) to white (the most), returns false if the file can't be written
+bool m8080_heat_pgm(const m8080_heat* const h, const char* const path, const int kind);
+// writes `prefix`.csv and an image per kind, `prefix`-read.pgm and so on
+bool m8080_heat_save(const m8080_heat* const h, const char* const prefix);
+
+#endif // M8080_HEAT_H
+
+#ifdef M8080_HEAT_IMPLEMENTATION
+#undef M8080_HEAT_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void m8080_heat_read(m8080_heat* const h, const uint16_t a) {
+  ++h->count[M8080_HEAT_READ][a >> h->shift];
+}
+
+void m8080_heat_write(m8080_heat* const h, const uint16_t a) {
+  ++h->count[M8080_HEAT_WRITE][a >> h->shift];
+}
+
+static uint8_t m8080_heat_rb(const m8080* const c, const uint16_t a) {
+  // the callbacks are the first thing in the heatmap
+  m8080_heat* const h = (m8080_heat*)c->cb;
+  m8080_heat_read(h, a);
+  return h->user->rb(c, a);
+}
+
+static void m8080_heat_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  m8080_heat* const h = (m8080_heat*)c->cb;
+  m8080_heat_write(h, a);
+  h->user->wb(c, a, b);
+}
+
+bool m8080_heat_open(m8080_heat* const h, m8080* const c, const unsigned shift) {
+  memset(h, 0, sizeof(*h));
+  h->shift = shift > 16 ? 16 : shift;
+  for(size_t i = 0; i < M8080_HEAT_KINDS; ++i) {
+    h->count[i] = calloc((0x10000 >> h->shift) + 1, sizeof(uint64_t));
+    if(!h->count[i]) {
+      for(size_t j = 0; j < i; ++j) free(h->count[j]);
+      return false;
+    }
+  }
+  h->sp_min = 0xffff;
+
+  if(c->cb) h->cb = *c->cb;
+  h->user = c->cb;
+  h->cb.rb = m8080_heat_rb;
+  h->cb.wb = m8080_heat_wb;
+  c->cb = &h->cb;
+  return true;
+}
+
+void m8080_heat_close(m8080_heat* const h, m8080* const c) {
+  c->cb = h->user;
+  for(size_t i = 0; i < M8080_HEAT_KINDS; ++i) {
+    free(h->count[i]);
+    h->count[i] = NULL;
+  }
+}
+
+uint64_t m8080_heat_run_until(m8080_heat* const h, m8080* const c, const uint64_t deadline) {
+  const uint64_t previous_cycle = c->cycles;
+  uint64_t* const read = h->count[M8080_HEAT_READ];
+  uint64_t* const fetch = h->count[M8080_HEAT_FETCH];
+  m8080_watch w;
+  int event;
+  while((event = m8080_watch_next(c, deadline, &w)) != M8080_WATCH_END) {
+    if(event == M8080_WATCH_HALTED) continue;
+    if(event != M8080_WATCH_INTERRUPT) {
+      // the wrapped `rb` counted looking at the opcode and fetching the
+      // instruction as reads, a suspended instruction wasn't fetched at all
+      // and is fetched again once resumed
+      const int size = m8080_instruction_size(w.opcode);
+      --read[w.pc >> h->shift];
+      for(int i = 0; i < size; ++i) {
+        const uint16_t a = w.pc + i;
+        --read[a >> h->shift];
+        if(event == M8080_WATCH_INSTRUCTION) ++fetch[a >> h->shift];
+      }
+      if(event == M8080_WATCH_SUSPENDED) continue;
+    }
+
+    ++h->count[M8080_HEAT_STACK][c->sp >> h->shift];
+    if(c->sp < h->sp_min) h->sp_min = c->sp;
+    if(c->sp > h->sp_max) h->sp_max = c->sp;
+    ++h->instructions;
+  }
+  return c->cycles - previous_cycle;
+}
+
+uint64_t m8080_heat_run(m8080_heat* const h, m8080* const c, const uint64_t cycles) {
+  return m8080_heat_run_until(h, c, m8080_next_deadline(c, cycles));
+}
+
+bool m8080_heat_csv(const m8080_heat* const h, const char* const path) {
+  FILE* const f = fopen(path, "w");
+  if(!f) return false;
+  fprintf(f, "address,reads,writes,fetches,stack\n");
+  for(size_t i = 0; i < 0x10000 >> h->shift; ++i) {
+    uint64_t any = 0;
+    for(size_t j = 0; j < M8080_HEAT_KINDS; ++j) any |= h->count[j][i];
+    if(!any) continue;
+    fprintf(f, "0x%04zx,%llu,%llu,%llu,%llu\n", i << h->shift,
+        (unsigned long long)h->count[M8080_HEAT_READ][i],
+        (unsigned long long)h->count[M8080_HEAT_WRITE][i],
+        (unsigned long long)h->count[M8080_HEAT_FETCH][i],
+        (unsigned long long)h->count[M8080_HEAT_STACK][i]);
+  }
+  return fclose(f) == 0;
+}
+
+// number of significant bits, a logarithmic scale without libm
+static inline int m8080_heat_bits(uint64_t n) {
+  int bits = 0;
+  for(; n; n >>= 1) ++bits;
+  return bits;
+}
+
+bool m8080_heat_pgm(const m8080_heat* const h, const char* const path, const int kind) {
+  if(kind < 0 || kind >= M8080_HEAT_KINDS) return false;
+  const uint64_t* const count = h->count[kind];
+  uint64_t max = 0;
+  for(size_t i = 0; i < 0x10000 >> h->shift; ++i) {
+    if(count[i] > max) max = count[i];
+  }
+  const int top = m8080_heat_bits(max);
+
+  FILE* const f = fopen(path, "wb");
+  if(!f) return false;
+  fprintf(f, "P5\n256 256\n255\n");
+  uint8_t row[256];
+  for(size_t y = 0; y < 256; ++y) {
+    for(size_t x = 0; x < 256; ++x) {
+      const int bits = m8080_heat_bits(count[(y << 8 | x) >> h->shift]);
+      row[x] = top ? bits * 255 / top : 0;
+    }
+    fwrite(row, 1, sizeof(row), f);
+  }
+  return fclose(f) == 0;
+}
+
+bool m8080_heat_save(const m8080_heat* const h, const char* const prefix) {
+  static const char* const kinds[M8080_HEAT_KINDS] = { "read", "write", "fetch", "stack" };
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.csv", prefix);
+  bool saved = m8080_heat_csv(h, path);
+  for(int i = 0; i < M8080_HEAT_KINDS; ++i) {
+    snprintf(path, sizeof(path), "%s-%s.pgm", prefix, kinds[i]);
+    saved &= m8080_heat_pgm(h, path, i);
+  }
+  return saved;
+}
+
+#endif // M8080_HEAT_IMPLEMENTATION
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
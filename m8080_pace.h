@@ -0,0 +1,143 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#ifndef M8080_PACE_H
+#define M8080_PACE_H
+// real-time pacing for `m8080`, keeps emulated time in step with
+// `CLOCK_MONOTONIC` (POSIX only)
+//
+// the user must define M8080_PACE_IMPLEMENTATION in exactly one file that
+// includes this header before the include, just like `m8080.h`:
+//
+//      #define M8080_PACE_IMPLEMENTATION
+//      #include "m8080_pace.h"
+//
+// a paced loop runs a slice and then waits for the wall clock to catch up:
+//
+//      m8080_pace p;
+//      m8080_pace_init(&p, c, M8080_HZ);
+//      while(1) {
+//        m8080_run(c, M8080_HZ / 60);
+//        m8080_pace_wait(&p, c);
+//      }
+//
+// wall time is derived from `c->cycles` instead of from the time the last
+// slice took, so late wake-ups don't accumulate into drift
+
+#include "m8080.h"
+
+#include <stdint.h>
+
+typedef struct m8080_pace {
+  uint64_t hz; // emulated clock rate
+  // emulated speed relative to `hz`, 1.0 is real time, 0 is unthrottled
+  double speed;
+  // longest single sleep in nanoseconds, sleeping in small quanta keeps wake-up
+  // jitter low on hosts with coarse timers
+  uint64_t quantum;
+  // how far behind (in nanoseconds) the emulation may fall before giving up on
+  // catching up, after a long host stall at most this much emulated time is
+  // run as fast as possible and the rest is dropped
+  uint64_t max_lag;
+  // wall time and cycle count at which `speed` last changed
+  uint64_t origin_ns;
+  uint64_t origin_cycles;
+} m8080_pace;
+
+// current `CLOCK_MONOTONIC` time in nanoseconds
+uint64_t m8080_pace_now(void);
+// starts pacing `c` at real time speed from now
+void m8080_pace_init(m8080_pace* const p, const m8080* const c, const uint64_t hz);
+// changes the speed without jumping, 0 disables throttling
+void m8080_pace_speed(m8080_pace* const p, const m8080* const c, const double speed);
+// sleeps until the wall clock reaches the time corresponding to `c->cycles`,
+// returns how many nanoseconds behind the emulation was (0 if it was ahead)
+uint64_t m8080_pace_wait(m8080_pace* const p, const m8080* const c);
+
+#endif // M8080_PACE_H
+
+#ifdef M8080_PACE_IMPLEMENTATION
+#undef M8080_PACE_IMPLEMENTATION
+
+#include <errno.h>
+#include <time.h>
+
+uint64_t m8080_pace_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void m8080_pace_init(m8080_pace* const p, const m8080* const c, const uint64_t hz) {
+  p->hz = hz;
+  p->speed = 1.0;
+  p->quantum = 1000000; // 1 ms
+  p->max_lag = 100000000; // 100 ms
+  p->origin_ns = m8080_pace_now();
+  p->origin_cycles = c->cycles;
+}
+
+// wall time at which the emulation should reach `cycles`
+static inline uint64_t m8080_pace_target(const m8080_pace* const p, const uint64_t cycles) {
+  const uint64_t ns = m8080_cycles_to_ns(cycles - p->origin_cycles, p->hz);
+  return p->origin_ns + (uint64_t)(ns / p->speed);
+}
+
+void m8080_pace_speed(m8080_pace* const p, const m8080* const c, const double speed) {
+  // rebase so that the time already emulated keeps its old speed
+  p->origin_ns = p->speed > 0 ? m8080_pace_target(p, c->cycles) : m8080_pace_now();
+  p->origin_cycles = c->cycles;
+  p->speed = speed;
+}
+
+uint64_t m8080_pace_wait(m8080_pace* const p, const m8080* const c) {
+  if(p->speed <= 0) return 0;
+
+  const uint64_t target = m8080_pace_target(p, c->cycles);
+  uint64_t now = m8080_pace_now();
+
+  if(now > target) {
+    const uint64_t lag = now - target;
+    // the host stalled for too long, forget about the time that can't be
+    // made up so that the emulation doesn't run flat out for seconds
+    if(lag > p->max_lag) {
+      p->origin_ns += lag - p->max_lag;
+    }
+    return lag;
+  }
+
+  while(now < target) {
+    const uint64_t wake = target - now > p->quantum ? now + p->quantum : target;
+    const struct timespec ts = {
+      .tv_sec = wake / 1000000000,
+      .tv_nsec = wake % 1000000000,
+    };
+    // absolute sleeps don't drift when interrupted by a signal
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    now = m8080_pace_now();
+  }
+  return 0;
+}
+
+#endif // M8080_PACE_IMPLEMENTATION
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
@@ -0,0 +1,197 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#ifndef M8080_PERF_H
+#define M8080_PERF_H
+// host hardware performance counters around `m8080` run slices, to see what
+// the emulator costs the host CPU (Linux only, `perf_event_open`)
+//
+// the user must define M8080_PERF_IMPLEMENTATION in exactly one file that
+// includes this header before the include, just like `m8080.h`:
+//
+//      #define M8080_PERF_IMPLEMENTATION
+//      #include "m8080_perf.h"
+//
+// slices are run through the counters instead of directly, which adds two
+// reads of every counter per slice, so slices should be a frame or more:
+//
+//      m8080_perf p;
+//      m8080_perf_open(&p);
+//      for(int frame = 0; frame < 600; ++frame) m8080_perf_run(&p, c, M8080_HZ / 60);
+//      m8080_perf_print(&p, stdout);
+//      m8080_perf_close(&p);
+//
+// counters the host doesn't have (or isn't allowed to use, see
+// /proc/sys/kernel/perf_event_paranoid) read as zero, only user space is
+// counted so the emulator is measured and not the kernel
+
+#include "m8080.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum {
+  M8080_PERF_CYCLES,
+  M8080_PERF_INSTRUCTIONS,
+  M8080_PERF_BRANCHES,
+  M8080_PERF_BRANCH_MISSES,
+  M8080_PERF_CACHE_REFERENCES,
+  M8080_PERF_CACHE_MISSES,
+  M8080_PERF_COUNTERS,
+};
+
+typedef struct m8080_perf {
+  int fd[M8080_PERF_COUNTERS]; // -1 if the counter couldn't be opened
+  // host events counted since open or the last reset
+  uint64_t count[M8080_PERF_COUNTERS];
+  // readings at the start of the current slice
+  uint64_t start[M8080_PERF_COUNTERS];
+  // emulated cycles and slices the counts belong to
+  uint64_t cycles;
+  uint64_t slices;
+  uint64_t start_cycles;
+} m8080_perf;
+
+// opens the counters, returns false if none of them is available
+bool m8080_perf_open(m8080_perf* const p);
+void m8080_perf_close(m8080_perf* const p);
+void m8080_perf_reset(m8080_perf* const p);
+// a slice is anything between these two, the events are attributed to the
+// emulated cycles `c` executed in between
+void m8080_perf_begin(m8080_perf* const p, const m8080* const c);
+void m8080_perf_end(m8080_perf* const p, const m8080* const c);
+// `m8080_run` and N calls of `m8080_step` as one slice
+uint64_t m8080_perf_run(m8080_perf* const p, m8080* const c, const uint64_t cycles);
+uint64_t m8080_perf_steps(m8080_perf* const p, m8080* const c, const size_t steps);
+// prints IPC, branch and cache miss rates and events per emulated cycle and
+// per slice on one line
+void m8080_perf_print(const m8080_perf* const p, FILE* const f);
+
+#endif // M8080_PERF_H
+
+#ifdef M8080_PERF_IMPLEMENTATION
+#undef M8080_PERF_IMPLEMENTATION
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const uint64_t m8080_perf_config[M8080_PERF_COUNTERS] = {
+  [M8080_PERF_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+  [M8080_PERF_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+  [M8080_PERF_BRANCHES] = PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+  [M8080_PERF_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+  [M8080_PERF_CACHE_REFERENCES] = PERF_COUNT_HW_CACHE_REFERENCES,
+  [M8080_PERF_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+};
+
+bool m8080_perf_open(m8080_perf* const p) {
+  memset(p, 0, sizeof(*p));
+  bool any = false;
+  for(size_t i = 0; i < M8080_PERF_COUNTERS; ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = m8080_perf_config[i];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // counting, not sampling, of this thread on any CPU
+    p->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    any |= p->fd[i] >= 0;
+  }
+  return any;
+}
+
+void m8080_perf_close(m8080_perf* const p) {
+  for(size_t i = 0; i < M8080_PERF_COUNTERS; ++i) {
+    if(p->fd[i] >= 0) close(p->fd[i]);
+    p->fd[i] = -1;
+  }
+}
+
+void m8080_perf_reset(m8080_perf* const p) {
+  memset(p->count, 0, sizeof(p->count));
+  p->cycles = 0;
+  p->slices = 0;
+}
+
+static inline uint64_t m8080_perf_read(const int fd) {
+  uint64_t v = 0;
+  if(fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v)) return 0;
+  return v;
+}
+
+void m8080_perf_begin(m8080_perf* const p, const m8080* const c) {
+  p->start_cycles = c->cycles;
+  for(size_t i = 0; i < M8080_PERF_COUNTERS; ++i) p->start[i] = m8080_perf_read(p->fd[i]);
+}
+
+void m8080_perf_end(m8080_perf* const p, const m8080* const c) {
+  // read in reverse so that the cycle counter includes the least of the
+  // reads themselves
+  for(size_t i = M8080_PERF_COUNTERS; i-- > 0; ) {
+    p->count[i] += m8080_perf_read(p->fd[i]) - p->start[i];
+  }
+  p->cycles += c->cycles - p->start_cycles;
+  ++p->slices;
+}
+
+uint64_t m8080_perf_run(m8080_perf* const p, m8080* const c, const uint64_t cycles) {
+  m8080_perf_begin(p, c);
+  const uint64_t ran = m8080_run(c, cycles);
+  m8080_perf_end(p, c);
+  return ran;
+}
+
+uint64_t m8080_perf_steps(m8080_perf* const p, m8080* const c, const size_t steps) {
+  const uint64_t previous_cycle = c->cycles;
+  m8080_perf_begin(p, c);
+  for(size_t i = 0; i < steps; ++i) m8080_step(c);
+  m8080_perf_end(p, c);
+  return c->cycles - previous_cycle;
+}
+
+static inline double m8080_perf_ratio(const uint64_t x, const uint64_t y) {
+  return y ? (double)x / y : 0.0;
+}
+
+void m8080_perf_print(const m8080_perf* const p, FILE* const f) {
+  const uint64_t* const n = p->count;
+  fprintf(f, "IPC %.2f, branch misses %.2f%%, cache misses %.2f%%, "
+      "per emulated cycle: %.2f host cycles, %.2f instructions, %.4f branch misses, "
+      "per slice: %.0f host cycles\n",
+      m8080_perf_ratio(n[M8080_PERF_INSTRUCTIONS], n[M8080_PERF_CYCLES]),
+      100 * m8080_perf_ratio(n[M8080_PERF_BRANCH_MISSES], n[M8080_PERF_BRANCHES]),
+      100 * m8080_perf_ratio(n[M8080_PERF_CACHE_MISSES], n[M8080_PERF_CACHE_REFERENCES]),
+      m8080_perf_ratio(n[M8080_PERF_CYCLES], p->cycles),
+      m8080_perf_ratio(n[M8080_PERF_INSTRUCTIONS], p->cycles),
+      m8080_perf_ratio(n[M8080_PERF_BRANCH_MISSES], p->cycles),
+      m8080_perf_ratio(n[M8080_PERF_CYCLES], p->slices));
+}
+
+#endif // M8080_PERF_IMPLEMENTATION
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
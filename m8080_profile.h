@@ -0,0 +1,313 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#ifndef M8080_PROFILE_H
+#define M8080_PROFILE_H
+// call graph profiler for `m8080`, follows calls, rst, interrupts and returns
+// on a shadow stack and attributes every emulated cycle to the chain of
+// routines it was spent in, the result can be summed up per routine or
+// written in the folded stack format of flame graph tools:
+//
+//      $ flamegraph.pl program.folded >program.svg
+//
+// the user must define M8080_PROFILE_IMPLEMENTATION in exactly one file that
+// includes this header before the include, just like `m8080.h`:
+//
+//      #define M8080_PROFILE_IMPLEMENTATION
+//      #include "m8080_profile.h"
+//
+// a profiled machine runs its slices through the profiler instead of
+// directly:
+//
+//      m8080_profile p;
+//      m8080_profile_open(&p, c);
+//      for(int frame = 0; frame < 600; ++frame) m8080_profile_run(&p, c, M8080_HZ / 60);
+//      m8080_profile_folded(&p, "program.folded");
+//      m8080_profile_close(&p);
+//
+// routines are known by their entry address, and the routine running when the
+// profiler was opened by the address it was at
+//
+// a routine returns when a ret (or a trap, which environments use to return
+// from emulated calls) pops its return address, or anything below it, off the
+// stack, so routines that drop their return address and jump elsewhere are
+// left at the next return from one of their callers
+//
+// slices run one instruction at a time, see `m8080_watch_next`
+
+#include "m8080.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// frames the shadow stack holds, deeper calls are attributed to their caller
+#define M8080_PROFILE_DEPTH 1024
+
+// a routine called from a chain of routines
+typedef struct m8080_profile_node {
+  uint32_t parent; // the chain it was called from, none for the first node
+  uint16_t entry;
+  uint64_t calls;
+  uint64_t cycles; // spent in the routine itself
+} m8080_profile_node;
+
+typedef struct m8080_profile {
+  // the call tree, node 0 is where the profiler was opened
+  m8080_profile_node* nodes;
+  size_t count;
+  size_t capacity;
+  // children of every node by entry address, node index plus one, zero if
+  // empty
+  uint32_t* table;
+  size_t table_size;
+  // the shadow stack, every frame is the node called and where its return
+  // address is
+  struct {
+    uint32_t node;
+    uint16_t sp;
+  } stack[M8080_PROFILE_DEPTH];
+  size_t depth;
+  uint64_t instructions;
+  uint64_t dropped; // calls deeper than the shadow stack
+} m8080_profile;
+
+// per routine, the sum over every chain it was called from
+typedef struct m8080_profile_routine {
+  uint16_t entry;
+  uint64_t calls;
+  uint64_t inclusive; // with the routines it called, recursion counted once
+  uint64_t exclusive; // in the routine itself
+} m8080_profile_routine;
+
+// starts profiling `c`, returns false if out of memory
+bool m8080_profile_open(m8080_profile* const p, const m8080* const c);
+void m8080_profile_close(m8080_profile* const p);
+// `m8080_run_until` and `m8080_run` with the cycles attributed
+uint64_t m8080_profile_run_until(m8080_profile* const p, m8080* const c, const uint64_t deadline);
+uint64_t m8080_profile_run(m8080_profile* const p, m8080* const c, const uint64_t cycles);
+// every routine that ran, the most exclusive cycles first, the array must be
+// released with `free`, returns NULL if out of memory
+m8080_profile_routine* m8080_profile_routines(const m8080_profile* const p, size_t* const count);
+// one line per chain of routines that spent any cycles, the entry addresses
+// from the outermost routine separated by semicolons and the cycles, returns
+// false if the file can't be written
+bool m8080_profile_folded(const m8080_profile* const p, const char* const path);
+
+#endif // M8080_PROFILE_H
+
+#ifdef M8080_PROFILE_IMPLEMENTATION
+#undef M8080_PROFILE_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define M8080_PROFILE_NONE UINT32_MAX
+
+static inline size_t m8080_profile_hash(const uint32_t parent, const uint16_t entry) {
+  return ((uint64_t)parent << 16 | entry) * 0x9e3779b97f4a7c15 >> 32;
+}
+
+// the slot of the child of PARENT at ENTRY, or of the empty slot it would be
+// in
+static inline uint32_t* m8080_profile_slot(const m8080_profile* const p, const uint32_t parent, const uint16_t entry) {
+  const size_t mask = p->table_size - 1;
+  for(size_t i = m8080_profile_hash(parent, entry) & mask;; i = (i + 1) & mask) {
+    uint32_t* const slot = &p->table[i];
+    if(!*slot) return slot;
+    const m8080_profile_node* const node = &p->nodes[*slot - 1];
+    if(node->parent == parent && node->entry == entry) return slot;
+  }
+}
+
+static uint32_t m8080_profile_add(m8080_profile* const p, const uint32_t parent, const uint16_t entry) {
+  if(p->count == p->capacity) {
+    m8080_profile_node* const nodes = realloc(p->nodes, 2 * p->capacity * sizeof(*nodes));
+    if(!nodes) return M8080_PROFILE_NONE;
+    p->nodes = nodes;
+    p->capacity *= 2;
+  }
+  // at most half full
+  if(2 * (p->count + 1) > p->table_size) {
+    uint32_t* const table = calloc(2 * p->table_size, sizeof(*table));
+    if(!table) return M8080_PROFILE_NONE;
+    free(p->table);
+    p->table = table;
+    p->table_size *= 2;
+    for(size_t i = 1; i < p->count; ++i) {
+      *m8080_profile_slot(p, p->nodes[i].parent, p->nodes[i].entry) = i + 1;
+    }
+  }
+  const uint32_t i = p->count++;
+  p->nodes[i] = (m8080_profile_node){ .parent = parent, .entry = entry };
+  if(parent != M8080_PROFILE_NONE) *m8080_profile_slot(p, parent, entry) = i + 1;
+  return i;
+}
+
+bool m8080_profile_open(m8080_profile* const p, const m8080* const c) {
+  memset(p, 0, sizeof(*p));
+  p->capacity = 256;
+  p->table_size = 512;
+  p->nodes = malloc(p->capacity * sizeof(*p->nodes));
+  p->table = calloc(p->table_size, sizeof(*p->table));
+  if(!p->nodes || !p->table) {
+    m8080_profile_close(p);
+    return false;
+  }
+  m8080_profile_add(p, M8080_PROFILE_NONE, c->pc);
+  p->nodes[0].calls = 1;
+  return true;
+}
+
+void m8080_profile_close(m8080_profile* const p) {
+  free(p->nodes);
+  free(p->table);
+  p->nodes = NULL;
+  p->table = NULL;
+}
+
+static inline void m8080_profile_call(m8080_profile* const p, const m8080* const c) {
+  if(p->depth == M8080_PROFILE_DEPTH) {
+    ++p->dropped;
+    return;
+  }
+  const uint32_t parent = p->depth ? p->stack[p->depth - 1].node : 0;
+  const uint32_t slot = *m8080_profile_slot(p, parent, c->pc);
+  const uint32_t node = slot ? slot - 1 : m8080_profile_add(p, parent, c->pc);
+  if(node == M8080_PROFILE_NONE) {
+    ++p->dropped;
+    return;
+  }
+  ++p->nodes[node].calls;
+  p->stack[p->depth].node = node;
+  p->stack[p->depth].sp = c->sp;
+  ++p->depth;
+}
+
+// call, its undocumented copies, the conditional calls and rst
+static inline bool m8080_profile_is_call(const uint8_t opcode) {
+  return (opcode & 0xcf) == 0xcd || (opcode & 0xc7) == 0xc4 || (opcode & 0xc7) == 0xc7;
+}
+
+// ret, its undocumented copy and the conditional returns
+static inline bool m8080_profile_is_ret(const uint8_t opcode) {
+  return (opcode & 0xef) == 0xc9 || (opcode & 0xc7) == 0xc0;
+}
+
+uint64_t m8080_profile_run_until(m8080_profile* const p, m8080* const c, const uint64_t deadline) {
+  const uint64_t previous_cycle = c->cycles;
+  m8080_watch w;
+  int event;
+  while((event = m8080_watch_next(c, deadline, &w)) != M8080_WATCH_END) {
+    if(event == M8080_WATCH_SUSPENDED) continue;
+    // the calling instruction belongs to the caller, a halted CPU to the
+    // routine that halted it
+    const uint32_t node = p->depth ? p->stack[p->depth - 1].node : 0;
+    p->nodes[node].cycles += c->cycles - w.cycles;
+    if(event == M8080_WATCH_HALTED) continue;
+    ++p->instructions;
+
+    const uint8_t opcode = w.opcode;
+    if(c->sp == (uint16_t)(w.sp - 2)) {
+      if(event == M8080_WATCH_INTERRUPT || m8080_profile_is_call(opcode)) m8080_profile_call(p, c);
+    } else if(c->sp == (uint16_t)(w.sp + 2)) {
+      if(m8080_profile_is_ret(opcode) || (c->cb && c->cb->trap && m8080_is_trap(opcode))) {
+        while(p->depth && p->stack[p->depth - 1].sp < c->sp) --p->depth;
+      }
+    }
+  }
+  return c->cycles - previous_cycle;
+}
+
+uint64_t m8080_profile_run(m8080_profile* const p, m8080* const c, const uint64_t cycles) {
+  return m8080_profile_run_until(p, c, m8080_next_deadline(c, cycles));
+}
+
+static int m8080_profile_compare(const void* const x, const void* const y) {
+  const m8080_profile_routine* const a = x;
+  const m8080_profile_routine* const b = y;
+  if(a->exclusive != b->exclusive) return a->exclusive < b->exclusive ? 1 : -1;
+  if(a->inclusive != b->inclusive) return a->inclusive < b->inclusive ? 1 : -1;
+  return a->entry - b->entry;
+}
+
+m8080_profile_routine* m8080_profile_routines(const m8080_profile* const p, size_t* const count) {
+  m8080_profile_routine* const routines = calloc(0x10000, sizeof(*routines));
+  uint64_t* const total = malloc(p->count * sizeof(*total));
+  if(!routines || !total) {
+    free(routines);
+    free(total);
+    return NULL;
+  }
+
+  // children always come after their parents
+  for(size_t i = 0; i < p->count; ++i) total[i] = p->nodes[i].cycles;
+  for(size_t i = p->count; i-- > 1;) total[p->nodes[i].parent] += total[i];
+
+  for(size_t i = 0; i < p->count; ++i) {
+    const m8080_profile_node* const node = &p->nodes[i];
+    m8080_profile_routine* const r = &routines[node->entry];
+    r->entry = node->entry;
+    r->calls += node->calls;
+    r->exclusive += node->cycles;
+    // a recursive call is already part of the outermost one
+    bool outermost = true;
+    for(uint32_t j = node->parent; j != M8080_PROFILE_NONE && outermost; j = p->nodes[j].parent) {
+      outermost = p->nodes[j].entry != node->entry;
+    }
+    if(outermost) r->inclusive += total[i];
+  }
+  free(total);
+
+  size_t n = 0;
+  for(size_t i = 0; i < 0x10000; ++i) {
+    if(routines[i].calls) routines[n++] = routines[i];
+  }
+  qsort(routines, n, sizeof(*routines), m8080_profile_compare);
+  *count = n;
+  return routines;
+}
+
+bool m8080_profile_folded(const m8080_profile* const p, const char* const path) {
+  FILE* const f = fopen(path, "w");
+  if(!f) return false;
+  // the chain is found from the innermost routine out
+  uint32_t* const chain = malloc(p->count * sizeof(*chain));
+  if(!chain) {
+    fclose(f);
+    return false;
+  }
+  for(size_t i = 0; i < p->count; ++i) {
+    if(!p->nodes[i].cycles) continue;
+    size_t n = 0;
+    for(uint32_t j = i; j != M8080_PROFILE_NONE; j = p->nodes[j].parent) chain[n++] = j;
+    while(n--) fprintf(f, "0x%04x%c", p->nodes[chain[n]].entry, n ? ';' : ' ');
+    fprintf(f, "%llu\n", (unsigned long long)p->nodes[i].cycles);
+  }
+  free(chain);
+  return fclose(f) == 0;
+}
+
+#endif // M8080_PROFILE_IMPLEMENTATION
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
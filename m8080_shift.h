@@ -0,0 +1,98 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#ifndef M8080_SHIFT_H
+#define M8080_SHIFT_H
+// external 16-bit shift register used by Space Invaders (and other Midway 8080
+// boards) to draw sprites at any horizontal position, since the 8080 can only
+// shift by one bit at a time, wired to the port table (`c->ports`):
+//
+//      out 2 -> offset, only the least significant three bits are used
+//      out 4 -> data, shifted into the register from the top
+//      in 3  <- result, the most significant eight bits shifted left by offset
+//
+// the user must define M8080_SHIFT_IMPLEMENTATION in exactly one file that
+// includes this header before the include, just like `m8080.h`:
+//
+//      #define M8080_SHIFT_IMPLEMENTATION
+//      #include "m8080_shift.h"
+//
+//      m8080_shift s;
+//      m8080_shift_attach(&s, ports, 2, 4, 3);
+//
+// the result port has no `in` handler, the two `out` handlers keep the result
+// in its `value`, so the reads (as many as the writes in a sprite routine)
+// never leave `m8080_step`
+
+#include "m8080.h"
+
+#include <stdint.h>
+
+typedef struct m8080_shift {
+  uint16_t value;
+  uint8_t offset;
+  // the result port, its `value` is the result
+  m8080_port* result;
+} m8080_shift;
+
+// registers the shift register on ports OFFSET, DATA and RESULT of `ports`,
+// which must be three different ports
+void m8080_shift_attach(m8080_shift* const s, m8080_port* const ports,
+    const uint8_t offset, const uint8_t data, const uint8_t result);
+
+#endif // M8080_SHIFT_H
+
+#ifdef M8080_SHIFT_IMPLEMENTATION
+#undef M8080_SHIFT_IMPLEMENTATION
+
+static inline void m8080_shift_update(m8080_shift* const s) {
+  s->result->value = s->value >> (8 - s->offset);
+}
+
+static void m8080_shift_offset(m8080* const c, void* const ctx, const uint8_t a, const uint8_t b) {
+  m8080_shift* const s = ctx;
+  s->offset = b & 0x07;
+  m8080_shift_update(s);
+}
+
+static void m8080_shift_data(m8080* const c, void* const ctx, const uint8_t a, const uint8_t b) {
+  m8080_shift* const s = ctx;
+  s->value = b << 8 | s->value >> 8;
+  m8080_shift_update(s);
+}
+
+void m8080_shift_attach(m8080_shift* const s, m8080_port* const ports,
+    const uint8_t offset, const uint8_t data, const uint8_t result) {
+  s->value = 0;
+  s->offset = 0;
+  ports[offset].out = m8080_shift_offset;
+  ports[offset].ctx = s;
+  ports[data].out = m8080_shift_data;
+  ports[data].ctx = s;
+  ports[result].in = NULL;
+  s->result = &ports[result];
+  m8080_shift_update(s);
+}
+
+#endif // M8080_SHIFT_IMPLEMENTATION
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
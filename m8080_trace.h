@@ -0,0 +1,724 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#ifndef M8080_TRACE_H
+#define M8080_TRACE_H
+// binary execution traces for `m8080`, every instruction is recorded as the
+// registers it changed and the bytes it wrote (POSIX threads)
+//
+// the user must define M8080_TRACE_IMPLEMENTATION in exactly one file that
+// includes this header before the include, just like `m8080.h`:
+//
+//      #define M8080_TRACE_IMPLEMENTATION
+//      #include "m8080_trace.h"
+//
+// a traced machine is stepped through the trace instead of directly:
+//
+//      m8080_trace t;
+//      m8080_trace_open(&t, c, "run.trace", true);
+//      while(running) m8080_trace_step(&t, c);
+//      m8080_trace_close(&t, c);
+//
+// and the trace is read back one instruction at a time, from the start or
+// from any cycle:
+//
+//      m8080_trace_reader r;
+//      m8080_trace_reader_open(&r, "run.trace");
+//      m8080_trace_seek(&r, 1000000);
+//      m8080_trace_record rec;
+//      while(m8080_trace_next(&r, &rec)) inspect(&rec);
+//      m8080_trace_reader_close(&r);
+//
+// records go into blocks, every block starts with the whole register state so
+// it can be decoded on its own, and after that a record is a byte telling
+// which registers changed, the program counter and cycle deltas as varints,
+// the changed registers and the writes, which is a few bytes per instruction
+//
+// full blocks are handed to a background thread through a lock-free
+// single-producer single-consumer ring, the thread optionally compresses them
+// (LZ77, in the spirit of LZ4) and writes them out, the emulating thread only
+// waits if the disk can't keep up
+//
+// the trace sees memory writes by wrapping `c->cb->wb`, with
+// M8080_EXTERN_CALLBACKS `m8080_wb` must call `m8080_trace_write` itself, and
+// memory changed behind the CPU's back (e.g. by a trap handler) isn't seen
+//
+// a traced machine only executes instructions through `m8080_step`, so
+// interrupts have to be given with `m8080_interrupt`, what it pushes is
+// recorded with the next instruction
+
+#include "m8080.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+// size of a block before compression
+#define M8080_TRACE_BLOCK 0x10000
+// blocks waiting to be written before the emulating thread has to wait
+#define M8080_TRACE_BLOCKS 8
+// writes kept per instruction, an instruction writes at most two bytes, more
+// can only come from callbacks and are counted in `lost`
+#define M8080_TRACE_WRITES 64
+
+// the state after an instruction and the bytes it wrote
+typedef struct m8080_trace_record {
+  uint64_t cycles;
+  uint16_t pc, sp, psw, bc, de, hl;
+  uint8_t inte, halted;
+  size_t writes;
+  uint16_t write_address[M8080_TRACE_WRITES];
+  uint8_t write_value[M8080_TRACE_WRITES];
+} m8080_trace_record;
+
+typedef struct m8080_trace {
+  // the callbacks of the traced machine, with `wb` wrapped, must be first
+  m8080_callbacks cb;
+  const m8080_callbacks* user; // the callbacks being wrapped
+  FILE* file;
+  bool compress;
+  size_t lost; // writes that didn't fit in a record
+
+  // used by the emulating thread
+  m8080_trace_record last; // state before the next instruction
+  uint16_t last_write;
+  uint8_t* block; // block being filled
+  size_t used;
+
+  // the ring, `head` is only written by the emulating thread and `tail` by
+  // the writer thread
+  uint8_t* ring;
+  size_t size[M8080_TRACE_BLOCKS];
+  uint64_t first[M8080_TRACE_BLOCKS]; // cycle count at the start of each block
+  atomic_size_t head, tail;
+  atomic_bool done;
+  pthread_t thread;
+
+  // used by the writer thread, one index entry per block
+  uint8_t* packed;
+  uint64_t offset;
+  uint64_t* index;
+  size_t blocks;
+  size_t capacity;
+  bool failed;
+} m8080_trace;
+
+// creates the trace file and starts recording `c` from its current state,
+// returns false if the file can't be created
+bool m8080_trace_open(m8080_trace* const t, m8080* const c, const char* const path,
+    const bool compress);
+// executes and records one instruction, returns its number of cycles
+size_t m8080_trace_step(m8080_trace* const t, m8080* const c);
+// records a write, called by the wrapped `wb`
+void m8080_trace_write(m8080_trace* const t, const uint16_t a, const uint8_t b);
+// writes the remaining blocks and the index and gives `c` its callbacks back,
+// returns false if anything couldn't be written
+bool m8080_trace_close(m8080_trace* const t, m8080* const c);
+
+typedef struct m8080_trace_reader {
+  FILE* file;
+  // cycle count at the start of each block and where it is in the file
+  uint64_t* first;
+  uint64_t* offset;
+  size_t blocks;
+  // current block
+  size_t block;
+  uint8_t* raw;
+  uint8_t* packed;
+  size_t size;
+  size_t position;
+  m8080_trace_record last;
+  uint16_t last_write;
+} m8080_trace_reader;
+
+// opens a trace and reads its index, returns false if it isn't a valid trace
+bool m8080_trace_reader_open(m8080_trace_reader* const r, const char* const path);
+void m8080_trace_reader_close(m8080_trace_reader* const r);
+// reads the next instruction, returns false at the end of the trace
+bool m8080_trace_next(m8080_trace_reader* const r, m8080_trace_record* const rec);
+// moves to the last instruction boundary at or before `cycles`, `r->last` is
+// the state there and `m8080_trace_next` continues from it, only one block is
+// decoded
+bool m8080_trace_seek(m8080_trace_reader* const r, const uint64_t cycles);
+
+#endif // M8080_TRACE_H
+
+#ifdef M8080_TRACE_IMPLEMENTATION
+#undef M8080_TRACE_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define M8080_TRACE_MAGIC "m8080trc"
+#define M8080_TRACE_INDEX "m8080idx"
+#define M8080_TRACE_VERSION 1
+
+// which registers a record carries
+enum {
+  M8080_TRACE_A = 0x01, M8080_TRACE_F = 0x02,
+  M8080_TRACE_BC = 0x04, M8080_TRACE_DE = 0x08,
+  M8080_TRACE_HL = 0x10, M8080_TRACE_SP = 0x20,
+  M8080_TRACE_WRITES_FOLLOW = 0x40, M8080_TRACE_STATE = 0x80,
+};
+
+// largest encoded record: mask, pc delta, cycle delta, registers, state,
+// write count and the writes
+#define M8080_TRACE_RECORD (1 + 3 + 10 + 10 + 1 + 2 + M8080_TRACE_WRITES * 4)
+// the state at the start of every block
+#define M8080_TRACE_KEY (8 + 12 + 2)
+
+// compressed blocks can be a little larger than raw ones
+#define M8080_TRACE_PACKED (M8080_TRACE_BLOCK + M8080_TRACE_BLOCK / 255 + 16)
+// LZ77 hash table size in bits
+#define M8080_TRACE_HASH 12
+
+static inline uint8_t* m8080_trace_varint(uint8_t* p, uint64_t v) {
+  while(v >= 0x80) {
+    *p++ = v | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+static inline uint64_t m8080_trace_unvarint(const uint8_t** const p) {
+  uint64_t v = 0;
+  for(int shift = 0; ; shift += 7) {
+    const uint8_t b = *(*p)++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if(!(b & 0x80) || shift >= 63) return v;
+  }
+}
+
+// deltas of 16-bit addresses wrap around, so the shortest direction is encoded
+static inline uint32_t m8080_trace_zigzag(const uint16_t from, const uint16_t to) {
+  const int16_t d = (int16_t)(uint16_t)(to - from);
+  return d < 0 ? ~((uint32_t)d << 1) : (uint32_t)d << 1;
+}
+
+static inline uint16_t m8080_trace_unzigzag(const uint16_t from, const uint32_t z) {
+  return from + (uint16_t)(z & 1 ? ~(z >> 1) : z >> 1);
+}
+
+static inline uint8_t* m8080_trace_u16(uint8_t* p, const uint16_t v) {
+  *p++ = v;
+  *p++ = v >> 8;
+  return p;
+}
+
+static inline uint16_t m8080_trace_get16(const uint8_t** const p) {
+  const uint16_t v = (*p)[0] | (*p)[1] << 8;
+  *p += 2;
+  return v;
+}
+
+static inline uint8_t* m8080_trace_u64(uint8_t* p, const uint64_t v) {
+  for(int i = 0; i < 8; ++i) *p++ = v >> 8 * i;
+  return p;
+}
+
+static inline uint64_t m8080_trace_get64(const uint8_t** const p) {
+  uint64_t v = 0;
+  for(int i = 0; i < 8; ++i) v |= (uint64_t)(*p)[i] << 8 * i;
+  *p += 8;
+  return v;
+}
+
+// the whole register state, at the start of a block
+static uint8_t* m8080_trace_key(uint8_t* p, const m8080_trace_record* const s) {
+  p = m8080_trace_u64(p, s->cycles);
+  p = m8080_trace_u16(p, s->pc);
+  p = m8080_trace_u16(p, s->sp);
+  p = m8080_trace_u16(p, s->psw);
+  p = m8080_trace_u16(p, s->bc);
+  p = m8080_trace_u16(p, s->de);
+  p = m8080_trace_u16(p, s->hl);
+  *p++ = s->inte;
+  *p++ = s->halted;
+  return p;
+}
+
+static const uint8_t* m8080_trace_unkey(const uint8_t* p, m8080_trace_record* const s) {
+  s->cycles = m8080_trace_get64(&p);
+  s->pc = m8080_trace_get16(&p);
+  s->sp = m8080_trace_get16(&p);
+  s->psw = m8080_trace_get16(&p);
+  s->bc = m8080_trace_get16(&p);
+  s->de = m8080_trace_get16(&p);
+  s->hl = m8080_trace_get16(&p);
+  s->inte = *p++;
+  s->halted = *p++;
+  s->writes = 0;
+  return p;
+}
+
+// length of a literal run or a match, 15 and up continue in extra bytes
+static inline uint8_t* m8080_trace_length(uint8_t* p, size_t n) {
+  for(n -= 15; n >= 255; n -= 255) *p++ = 255;
+  *p++ = n;
+  return p;
+}
+
+// a run of literals followed by a match (unless it is the last run), the
+// token holds both lengths, like LZ4
+static uint8_t* m8080_trace_sequence(uint8_t* p, const uint8_t* const literals,
+    const size_t n, const size_t offset, const size_t match) {
+  const size_t m = match ? match - 4 : 0;
+  *p++ = (n < 15 ? n : 15) << 4 | (m < 15 ? m : 15);
+  if(n >= 15) p = m8080_trace_length(p, n);
+  memcpy(p, literals, n);
+  p += n;
+  if(!match) return p;
+  p = m8080_trace_u16(p, offset);
+  if(m >= 15) p = m8080_trace_length(p, m);
+  return p;
+}
+
+static size_t m8080_trace_pack(const uint8_t* const src, const size_t n, uint8_t* const dst) {
+  // positions plus one, 0 is empty
+  uint32_t table[1 << M8080_TRACE_HASH] = {0};
+  uint8_t* p = dst;
+  size_t i = 0;
+  size_t anchor = 0;
+  while(i + 4 <= n) {
+    uint32_t v;
+    memcpy(&v, src + i, 4);
+    const uint32_t h = (v * 2654435761u) >> (32 - M8080_TRACE_HASH);
+    const size_t candidate = table[h];
+    table[h] = i + 1;
+    if(candidate && i - (candidate - 1) <= 0xffff && !memcmp(src + candidate - 1, src + i, 4)) {
+      const size_t from = candidate - 1;
+      size_t length = 4;
+      while(i + length < n && src[from + length] == src[i + length]) ++length;
+      p = m8080_trace_sequence(p, src + anchor, i - anchor, i - from, length);
+      i += length;
+      anchor = i;
+    } else {
+      ++i;
+    }
+  }
+  p = m8080_trace_sequence(p, src + anchor, n - anchor, 0, 0);
+  return p - dst;
+}
+
+static inline bool m8080_trace_unlength(const uint8_t** const p, const uint8_t* const end,
+    size_t* const n) {
+  uint8_t b;
+  do {
+    if(*p >= end) return false;
+    b = *(*p)++;
+    *n += b;
+  } while(b == 255);
+  return true;
+}
+
+// returns false if `src` isn't exactly `n` bytes once unpacked
+static bool m8080_trace_unpack(const uint8_t* src, const size_t size, uint8_t* const dst,
+    const size_t n) {
+  const uint8_t* const end = src + size;
+  size_t o = 0;
+  while(src < end) {
+    const uint8_t token = *src++;
+    size_t literals = token >> 4;
+    if(literals == 15 && !m8080_trace_unlength(&src, end, &literals)) return false;
+    if(literals > (size_t)(end - src) || literals > n - o) return false;
+    memcpy(dst + o, src, literals);
+    src += literals;
+    o += literals;
+    if(src == end) break;
+
+    if(end - src < 2) return false;
+    const size_t offset = m8080_trace_get16(&src);
+    size_t match = token & 15;
+    if(match == 15 && !m8080_trace_unlength(&src, end, &match)) return false;
+    match += 4;
+    if(!offset || offset > o || match > n - o) return false;
+    // matches may overlap what they copy
+    for(size_t i = 0; i < match; ++i, ++o) dst[o] = dst[o - offset];
+  }
+  return o == n;
+}
+
+static inline void m8080_trace_nap(void) {
+  const struct timespec ts = { 0, 100000 };
+  nanosleep(&ts, NULL);
+}
+
+static bool m8080_trace_put(m8080_trace* const t, const void* const data, const size_t n) {
+  if(fwrite(data, 1, n, t->file) != n) return false;
+  t->offset += n;
+  return true;
+}
+
+// writes one block as raw size, stored size and data, the stored size equals
+// the raw size when compression didn't help
+static void m8080_trace_flush(m8080_trace* const t, const size_t slot) {
+  const uint8_t* const raw = t->ring + slot * M8080_TRACE_BLOCK;
+  const size_t size = t->size[slot];
+  const uint8_t* data = raw;
+  size_t stored = size;
+  if(t->compress) {
+    const size_t packed = m8080_trace_pack(raw, size, t->packed);
+    if(packed < size) {
+      data = t->packed;
+      stored = packed;
+    }
+  }
+
+  if(t->blocks == t->capacity) {
+    const size_t capacity = t->capacity ? 2 * t->capacity : 256;
+    uint64_t* const index = realloc(t->index, capacity * 2 * sizeof(uint64_t));
+    if(!index) {
+      t->failed = true;
+      return;
+    }
+    t->index = index;
+    t->capacity = capacity;
+  }
+  t->index[2 * t->blocks + 0] = t->first[slot];
+  t->index[2 * t->blocks + 1] = t->offset;
+  ++t->blocks;
+
+  uint8_t header[8];
+  uint8_t* p = header;
+  *p++ = size; *p++ = size >> 8; *p++ = size >> 16; *p++ = size >> 24;
+  *p++ = stored; *p++ = stored >> 8; *p++ = stored >> 16; *p++ = stored >> 24;
+  if(!m8080_trace_put(t, header, 8) || !m8080_trace_put(t, data, stored)) t->failed = true;
+}
+
+static void* m8080_trace_writer(void* const arg) {
+  m8080_trace* const t = arg;
+  for(;;) {
+    const size_t tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+    if(tail == atomic_load_explicit(&t->head, memory_order_acquire)) {
+      // `done` is set after the last block is published
+      if(atomic_load_explicit(&t->done, memory_order_acquire)
+          && tail == atomic_load_explicit(&t->head, memory_order_acquire)) break;
+      m8080_trace_nap();
+      continue;
+    }
+    m8080_trace_flush(t, tail % M8080_TRACE_BLOCKS);
+    atomic_store_explicit(&t->tail, tail + 1, memory_order_release);
+  }
+  return NULL;
+}
+
+static inline void m8080_trace_capture(m8080_trace_record* const s, const m8080* const c) {
+  s->cycles = c->cycles;
+  s->pc = c->pc;
+  s->sp = c->sp;
+  s->psw = c->psw;
+  s->bc = c->bc;
+  s->de = c->de;
+  s->hl = c->hl;
+  s->inte = c->inte;
+  s->halted = c->halted;
+}
+
+// starts filling the next free slot of the ring with a key
+static void m8080_trace_begin(m8080_trace* const t) {
+  const size_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+  while(head - atomic_load_explicit(&t->tail, memory_order_acquire) >= M8080_TRACE_BLOCKS) {
+    m8080_trace_nap();
+  }
+  const size_t slot = head % M8080_TRACE_BLOCKS;
+  t->block = t->ring + slot * M8080_TRACE_BLOCK;
+  t->first[slot] = t->last.cycles;
+  t->used = m8080_trace_key(t->block, &t->last) - t->block;
+  t->last_write = 0;
+}
+
+static void m8080_trace_publish(m8080_trace* const t) {
+  const size_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+  t->size[head % M8080_TRACE_BLOCKS] = t->used;
+  atomic_store_explicit(&t->head, head + 1, memory_order_release);
+}
+
+static void m8080_trace_wb(m8080* const c, const uint16_t a, const uint8_t b) {
+  // the callbacks are the first thing in the trace
+  m8080_trace* const t = (m8080_trace*)c->cb;
+  t->user->wb(c, a, b);
+  m8080_trace_write(t, a, b);
+}
+
+void m8080_trace_write(m8080_trace* const t, const uint16_t a, const uint8_t b) {
+  if(t->last.writes == M8080_TRACE_WRITES) {
+    ++t->lost;
+    return;
+  }
+  t->last.write_address[t->last.writes] = a;
+  t->last.write_value[t->last.writes] = b;
+  ++t->last.writes;
+}
+
+bool m8080_trace_open(m8080_trace* const t, m8080* const c, const char* const path,
+    const bool compress) {
+  memset(t, 0, sizeof(*t));
+  t->compress = compress;
+  t->ring = malloc((size_t)M8080_TRACE_BLOCKS * M8080_TRACE_BLOCK);
+  t->packed = malloc(M8080_TRACE_PACKED);
+  t->file = fopen(path, "wb");
+  if(!t->ring || !t->packed || !t->file) goto fail;
+
+  uint8_t header[12];
+  memcpy(header, M8080_TRACE_MAGIC, 8);
+  header[8] = M8080_TRACE_VERSION;
+  header[9] = header[10] = header[11] = 0;
+  if(!m8080_trace_put(t, header, sizeof(header))) goto fail;
+
+  atomic_init(&t->head, 0);
+  atomic_init(&t->tail, 0);
+  atomic_init(&t->done, false);
+  if(pthread_create(&t->thread, NULL, m8080_trace_writer, t)) goto fail;
+
+  if(c->cb) t->cb = *c->cb;
+  t->user = c->cb;
+  t->cb.wb = m8080_trace_wb;
+  c->cb = &t->cb;
+
+  m8080_trace_capture(&t->last, c);
+  m8080_trace_begin(t);
+  return true;
+
+fail:
+  if(t->file) fclose(t->file);
+  free(t->ring);
+  free(t->packed);
+  return false;
+}
+
+size_t m8080_trace_step(m8080_trace* const t, m8080* const c) {
+  if(t->used + M8080_TRACE_RECORD > M8080_TRACE_BLOCK) {
+    m8080_trace_publish(t);
+    m8080_trace_begin(t);
+  }
+
+  // `s->writes` already holds whatever was written since the last step, such
+  // as the return address pushed by `m8080_interrupt`
+  m8080_trace_record* const s = &t->last;
+  const size_t cycles = m8080_step(c);
+
+  uint8_t mask = 0;
+  if(c->a != s->psw >> 8) mask |= M8080_TRACE_A;
+  if(c->f != (s->psw & 0xff)) mask |= M8080_TRACE_F;
+  if(c->bc != s->bc) mask |= M8080_TRACE_BC;
+  if(c->de != s->de) mask |= M8080_TRACE_DE;
+  if(c->hl != s->hl) mask |= M8080_TRACE_HL;
+  if(c->sp != s->sp) mask |= M8080_TRACE_SP;
+  if(s->writes) mask |= M8080_TRACE_WRITES_FOLLOW;
+  if(c->inte != s->inte || c->halted != s->halted) mask |= M8080_TRACE_STATE;
+
+  uint8_t* p = t->block + t->used;
+  *p++ = mask;
+  p = m8080_trace_varint(p, m8080_trace_zigzag(s->pc, c->pc));
+  p = m8080_trace_varint(p, c->cycles - s->cycles);
+  if(mask & M8080_TRACE_A) *p++ = c->a;
+  if(mask & M8080_TRACE_F) *p++ = c->f;
+  if(mask & M8080_TRACE_BC) p = m8080_trace_u16(p, c->bc);
+  if(mask & M8080_TRACE_DE) p = m8080_trace_u16(p, c->de);
+  if(mask & M8080_TRACE_HL) p = m8080_trace_u16(p, c->hl);
+  if(mask & M8080_TRACE_SP) p = m8080_trace_u16(p, c->sp);
+  if(mask & M8080_TRACE_STATE) *p++ = c->inte | c->halted << 1;
+  if(mask & M8080_TRACE_WRITES_FOLLOW) {
+    p = m8080_trace_varint(p, s->writes);
+    for(size_t i = 0; i < s->writes; ++i) {
+      // pushes and calls write next to the previous write
+      p = m8080_trace_varint(p, m8080_trace_zigzag(t->last_write, s->write_address[i]));
+      *p++ = s->write_value[i];
+      t->last_write = s->write_address[i];
+    }
+  }
+  t->used = p - t->block;
+
+  m8080_trace_capture(s, c);
+  s->writes = 0;
+  return cycles;
+}
+
+bool m8080_trace_close(m8080_trace* const t, m8080* const c) {
+  c->cb = t->user;
+  m8080_trace_publish(t);
+  atomic_store_explicit(&t->done, true, memory_order_release);
+  pthread_join(t->thread, NULL);
+
+  // the index goes at the end, followed by its length and its own magic
+  bool ok = !t->failed;
+  uint8_t entry[16];
+  for(size_t i = 0; ok && i < t->blocks; ++i) {
+    m8080_trace_u64(m8080_trace_u64(entry, t->index[2 * i]), t->index[2 * i + 1]);
+    ok = m8080_trace_put(t, entry, 16);
+  }
+  if(ok) {
+    m8080_trace_u64(entry, t->blocks);
+    memcpy(entry + 8, M8080_TRACE_INDEX, 8);
+    ok = m8080_trace_put(t, entry, 16);
+  }
+  if(fclose(t->file)) ok = false;
+
+  free(t->ring);
+  free(t->packed);
+  free(t->index);
+  return ok;
+}
+
+static bool m8080_trace_load(m8080_trace_reader* const r, const size_t block) {
+  if(block >= r->blocks || fseek(r->file, r->offset[block], SEEK_SET)) return false;
+  uint8_t header[8];
+  if(fread(header, 1, 8, r->file) != 8) return false;
+  const size_t size = header[0] | header[1] << 8 | header[2] << 16 | (size_t)header[3] << 24;
+  const size_t stored = header[4] | header[5] << 8 | header[6] << 16 | (size_t)header[7] << 24;
+  if(size > M8080_TRACE_BLOCK || size < M8080_TRACE_KEY || stored > M8080_TRACE_PACKED) return false;
+
+  if(stored == size) {
+    if(fread(r->raw, 1, size, r->file) != size) return false;
+  } else if(fread(r->packed, 1, stored, r->file) != stored
+      || !m8080_trace_unpack(r->packed, stored, r->raw, size)) {
+    return false;
+  }
+
+  r->block = block;
+  r->size = size;
+  r->position = m8080_trace_unkey(r->raw, &r->last) - r->raw;
+  r->last_write = 0;
+  return true;
+}
+
+bool m8080_trace_reader_open(m8080_trace_reader* const r, const char* const path) {
+  memset(r, 0, sizeof(*r));
+  r->file = fopen(path, "rb");
+  if(!r->file) return false;
+
+  uint8_t header[16];
+  if(fread(header, 1, 12, r->file) != 12 || memcmp(header, M8080_TRACE_MAGIC, 8)
+      || header[8] != M8080_TRACE_VERSION) goto fail;
+  if(fseek(r->file, -16, SEEK_END) || fread(header, 1, 16, r->file) != 16
+      || memcmp(header + 8, M8080_TRACE_INDEX, 8)) goto fail;
+  const uint8_t* p = header;
+  r->blocks = m8080_trace_get64(&p);
+
+  const long end = ftell(r->file);
+  if(end < 0 || r->blocks > (uint64_t)end / 16) goto fail;
+  r->first = malloc((r->blocks + 1) * sizeof(uint64_t));
+  r->offset = malloc((r->blocks + 1) * sizeof(uint64_t));
+  r->raw = malloc(M8080_TRACE_BLOCK);
+  r->packed = malloc(M8080_TRACE_PACKED);
+  if(!r->first || !r->offset || !r->raw || !r->packed) goto fail;
+  if(fseek(r->file, end - 16 - (long)r->blocks * 16, SEEK_SET)) goto fail;
+  for(size_t i = 0; i < r->blocks; ++i) {
+    uint8_t entry[16];
+    if(fread(entry, 1, 16, r->file) != 16) goto fail;
+    p = entry;
+    r->first[i] = m8080_trace_get64(&p);
+    r->offset[i] = m8080_trace_get64(&p);
+  }
+
+  if(r->blocks && !m8080_trace_load(r, 0)) goto fail;
+  return true;
+
+fail:
+  m8080_trace_reader_close(r);
+  return false;
+}
+
+void m8080_trace_reader_close(m8080_trace_reader* const r) {
+  if(r->file) fclose(r->file);
+  free(r->first);
+  free(r->offset);
+  free(r->raw);
+  free(r->packed);
+  memset(r, 0, sizeof(*r));
+}
+
+bool m8080_trace_next(m8080_trace_reader* const r, m8080_trace_record* const rec) {
+  while(r->position >= r->size) {
+    if(r->block + 1 >= r->blocks || !m8080_trace_load(r, r->block + 1)) return false;
+  }
+
+  m8080_trace_record* const s = &r->last;
+  const uint8_t* p = r->raw + r->position;
+  const uint8_t mask = *p++;
+  s->pc = m8080_trace_unzigzag(s->pc, m8080_trace_unvarint(&p));
+  s->cycles += m8080_trace_unvarint(&p);
+  if(mask & M8080_TRACE_A) s->psw = (s->psw & 0x00ff) | *p++ << 8;
+  if(mask & M8080_TRACE_F) s->psw = (s->psw & 0xff00) | *p++;
+  if(mask & M8080_TRACE_BC) s->bc = m8080_trace_get16(&p);
+  if(mask & M8080_TRACE_DE) s->de = m8080_trace_get16(&p);
+  if(mask & M8080_TRACE_HL) s->hl = m8080_trace_get16(&p);
+  if(mask & M8080_TRACE_SP) s->sp = m8080_trace_get16(&p);
+  if(mask & M8080_TRACE_STATE) {
+    s->inte = *p & 1;
+    s->halted = *p++ >> 1;
+  }
+  s->writes = 0;
+  if(mask & M8080_TRACE_WRITES_FOLLOW) {
+    const uint64_t writes = m8080_trace_unvarint(&p);
+    for(uint64_t i = 0; i < writes; ++i) {
+      r->last_write = m8080_trace_unzigzag(r->last_write, m8080_trace_unvarint(&p));
+      const uint8_t b = *p++;
+      if(s->writes == M8080_TRACE_WRITES) continue;
+      s->write_address[s->writes] = r->last_write;
+      s->write_value[s->writes] = b;
+      ++s->writes;
+    }
+  }
+  r->position = p - r->raw;
+
+  if(rec) *rec = *s;
+  return true;
+}
+
+bool m8080_trace_seek(m8080_trace_reader* const r, const uint64_t cycles) {
+  if(!r->blocks) return false;
+  // last block starting at or before `cycles`
+  size_t low = 0, high = r->blocks;
+  while(high - low > 1) {
+    const size_t middle = low + (high - low) / 2;
+    if(r->first[middle] <= cycles) low = middle;
+    else high = middle;
+  }
+  if(!m8080_trace_load(r, low)) return false;
+
+  for(;;) {
+    const m8080_trace_record before = r->last;
+    const size_t block = r->block;
+    const size_t position = r->position;
+    const uint16_t last_write = r->last_write;
+    if(!m8080_trace_next(r, NULL)) return true;
+    if(r->last.cycles > cycles) {
+      // one too far, the next block may have been loaded to find it out
+      if(r->block != block && !m8080_trace_load(r, block)) return false;
+      r->last = before;
+      r->position = position;
+      r->last_write = last_write;
+      return true;
+    }
+  }
+}
+
+#endif // M8080_TRACE_IMPLEMENTATION
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
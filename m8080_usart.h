@@ -0,0 +1,409 @@
+/* Copyright (c) 2019 Pedro Minicz */
+#ifndef M8080_USART_H
+#define M8080_USART_H
+// serial port for `m8080` in the style of the Intel 8251 USART, wired to the
+// port table (`c->ports`), with lock-free rings to the host and optional
+// pseudo-terminal or Unix socket backends (POSIX only)
+//
+// the user must define M8080_USART_IMPLEMENTATION in exactly one file that
+// includes this header before the include, just like `m8080.h`:
+//
+//      #define M8080_USART_IMPLEMENTATION
+//      #include "m8080_usart.h"
+//
+// the pseudo-terminal functions are X/Open, so that file must also define
+// _XOPEN_SOURCE (600 or later) or _GNU_SOURCE before including anything
+//
+// the USART takes two ports, data and control (status when read):
+//
+//      m8080_usart u;
+//      m8080_usart_init(&u, 4096);
+//      m8080_usart_attach(&u, ports, 0x10, 0x11);
+//      m8080_usart_pty(&u, name, sizeof(name)); // or `m8080_usart_listen`
+//      while(1) {
+//        m8080_usart_pump(&u);
+//        m8080_run(c, M8080_HZ / 1000);
+//      }
+//
+// without a backend the host talks to the program through `u.rx` (bytes for
+// the program to receive) and `u.tx` (bytes it sent), each of them may be used
+// by one other thread while the CPU runs, and the thread running the CPU calls
+// `m8080_usart_update` between slices instead of `m8080_usart_pump`
+//
+// the status port has no `in` handler, it reads the snapshot in its `value`
+// that the data handlers and `m8080_usart_update` keep up to date, so polling
+// it never leaves `m8080_step` and with `fast_forward` a polling loop is
+// skipped to the end of the slice, the catch is that bytes the host writes to
+// `rx` in the middle of a slice are only seen by the program in the next one
+//
+// the mode (baud rate, character length, parity, stop bits) is kept but not
+// emulated, bytes go through as fast as the program and the host move them
+
+#include "m8080.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// single-producer single-consumer byte ring, the two indices only ever
+// increase and live on separate cache lines, each side keeps a copy of the
+// other side's index and only reloads it when the ring looks full or empty
+typedef struct m8080_ring {
+  // producer
+  _Alignas(M8080_CACHE_LINE) atomic_size_t head;
+  size_t tail_cache;
+  // consumer
+  _Alignas(M8080_CACHE_LINE) atomic_size_t tail;
+  size_t head_cache;
+  // shared and read-only
+  _Alignas(M8080_CACHE_LINE) uint8_t* data;
+  size_t mask; // size - 1, the size is a power of two
+} m8080_ring;
+
+// SIZE is rounded up to a power of two, returns false if out of memory
+bool m8080_ring_init(m8080_ring* const r, const size_t size);
+void m8080_ring_free(m8080_ring* const r);
+// producer side, copies up to N bytes in and returns how many fit
+size_t m8080_ring_write(m8080_ring* const r, const void* const data, const size_t n);
+// consumer side, copies up to N bytes out and returns how many there were
+size_t m8080_ring_read(m8080_ring* const r, void* const data, const size_t n);
+// the same without copying, the contiguous free (or filled) space is returned
+// in `*data` and made visible to the other side by `m8080_ring_commit` (or
+// released by `m8080_ring_consume`), so that a `read` or `write` system call
+// can go straight into the ring
+size_t m8080_ring_writable(m8080_ring* const r, uint8_t** const data);
+void m8080_ring_commit(m8080_ring* const r, const size_t n);
+size_t m8080_ring_readable(m8080_ring* const r, const uint8_t** const data);
+void m8080_ring_consume(m8080_ring* const r, const size_t n);
+
+// status bits
+#define M8080_USART_TXRDY  0x01 // `tx` has room
+#define M8080_USART_RXRDY  0x02 // `rx` has a byte
+#define M8080_USART_TXE    0x04 // `tx` is empty
+#define M8080_USART_DSR    0x80 // the host end is connected
+
+// command bits
+#define M8080_USART_TXEN   0x01 // transmit enable
+#define M8080_USART_RXE    0x04 // receive enable
+#define M8080_USART_RESET  0x40 // internal reset, the next control write is a mode
+
+typedef struct m8080_usart {
+  m8080_ring rx; // host to program
+  m8080_ring tx; // program to host
+  uint8_t mode;
+  uint8_t command;
+  bool expect_mode; // the next control write is a mode instead of a command
+  uint8_t data; // last byte received, read again while `rx` is empty
+  // the control port, its `value` is the status
+  m8080_port* status;
+  // backend, -1 if there is none, `listener` is the Unix socket accepting it
+  int fd;
+  int listener;
+} m8080_usart;
+
+// the rings hold SIZE bytes each, returns false if out of memory
+bool m8080_usart_init(m8080_usart* const u, const size_t size);
+// closes the backend too
+void m8080_usart_free(m8080_usart* const u);
+// registers the USART on ports DATA and CONTROL of `ports`
+void m8080_usart_attach(m8080_usart* const u, m8080_port* const ports,
+    const uint8_t data, const uint8_t control);
+// opens a pseudo-terminal as the backend and stores the name of the terminal
+// end (e.g. /dev/pts/3) in NAME, returns false on failure
+bool m8080_usart_pty(m8080_usart* const u, char* const name, const size_t size);
+// listens on the Unix socket PATH, one connection at a time is the backend,
+// returns false on failure
+bool m8080_usart_listen(m8080_usart* const u, const char* const path);
+// moves whatever the backend and the rings can take without blocking and
+// updates the status, returns false once the backend is closed for good
+bool m8080_usart_pump(m8080_usart* const u);
+// recomputes the status from the rings
+void m8080_usart_update(m8080_usart* const u);
+
+#endif // M8080_USART_H
+
+#ifdef M8080_USART_IMPLEMENTATION
+#undef M8080_USART_IMPLEMENTATION
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+bool m8080_ring_init(m8080_ring* const r, const size_t size) {
+  size_t n = 1;
+  while(n < size) n <<= 1;
+  memset(r, 0, sizeof(*r));
+  r->data = malloc(n);
+  r->mask = n - 1;
+  return r->data;
+}
+
+void m8080_ring_free(m8080_ring* const r) {
+  free(r->data);
+  r->data = NULL;
+}
+
+size_t m8080_ring_writable(m8080_ring* const r, uint8_t** const data) {
+  const size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  const size_t size = r->mask + 1;
+  if(head - r->tail_cache == size) {
+    r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+  }
+  const size_t room = size - (head - r->tail_cache);
+  const size_t end = size - (head & r->mask);
+  *data = r->data + (head & r->mask);
+  return room < end ? room : end;
+}
+
+void m8080_ring_commit(m8080_ring* const r, const size_t n) {
+  const size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  atomic_store_explicit(&r->head, head + n, memory_order_release);
+}
+
+size_t m8080_ring_readable(m8080_ring* const r, const uint8_t** const data) {
+  const size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  if(r->head_cache == tail) {
+    r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+  }
+  const size_t used = r->head_cache - tail;
+  const size_t end = r->mask + 1 - (tail & r->mask);
+  *data = r->data + (tail & r->mask);
+  return used < end ? used : end;
+}
+
+void m8080_ring_consume(m8080_ring* const r, const size_t n) {
+  const size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+}
+
+// both copy in up to two pieces, the second one after wrapping around
+size_t m8080_ring_write(m8080_ring* const r, const void* const data, const size_t n) {
+  size_t done = 0;
+  for(int i = 0; i < 2 && done < n; ++i) {
+    uint8_t* p;
+    size_t size = m8080_ring_writable(r, &p);
+    if(!size) break;
+    if(size > n - done) size = n - done;
+    memcpy(p, (const uint8_t*)data + done, size);
+    m8080_ring_commit(r, size);
+    done += size;
+  }
+  return done;
+}
+
+size_t m8080_ring_read(m8080_ring* const r, void* const data, const size_t n) {
+  size_t done = 0;
+  for(int i = 0; i < 2 && done < n; ++i) {
+    const uint8_t* p;
+    size_t size = m8080_ring_readable(r, &p);
+    if(!size) break;
+    if(size > n - done) size = n - done;
+    memcpy((uint8_t*)data + done, p, size);
+    m8080_ring_consume(r, size);
+    done += size;
+  }
+  return done;
+}
+
+bool m8080_usart_init(m8080_usart* const u, const size_t size) {
+  memset(u, 0, sizeof(*u));
+  u->expect_mode = true;
+  u->fd = -1;
+  u->listener = -1;
+  if(m8080_ring_init(&u->rx, size) && m8080_ring_init(&u->tx, size)) return true;
+  m8080_usart_free(u);
+  return false;
+}
+
+void m8080_usart_free(m8080_usart* const u) {
+  m8080_ring_free(&u->rx);
+  m8080_ring_free(&u->tx);
+  if(u->fd >= 0) close(u->fd);
+  if(u->listener >= 0) close(u->listener);
+  u->fd = -1;
+  u->listener = -1;
+}
+
+void m8080_usart_update(m8080_usart* const u) {
+  if(!u->status) return;
+  // this side writes `tx` and reads `rx`
+  uint8_t* q;
+  const uint8_t* p;
+  uint8_t status = 0;
+  if(u->command & M8080_USART_TXEN && m8080_ring_writable(&u->tx, &q)) {
+    status |= M8080_USART_TXRDY;
+  }
+  if(u->command & M8080_USART_RXE && m8080_ring_readable(&u->rx, &p)) {
+    status |= M8080_USART_RXRDY;
+  }
+  if(atomic_load_explicit(&u->tx.tail, memory_order_acquire)
+      == atomic_load_explicit(&u->tx.head, memory_order_relaxed)) {
+    status |= M8080_USART_TXE;
+  }
+  if(u->fd >= 0 || u->listener < 0) status |= M8080_USART_DSR;
+  u->status->value = status;
+}
+
+static uint8_t m8080_usart_in(m8080* const c, void* const ctx, const uint8_t a) {
+  m8080_usart* const u = ctx;
+  const uint8_t* p;
+  if(u->command & M8080_USART_RXE && m8080_ring_readable(&u->rx, &p)) {
+    u->data = *p;
+    m8080_ring_consume(&u->rx, 1);
+    m8080_usart_update(u);
+  }
+  return u->data;
+}
+
+static void m8080_usart_out(m8080* const c, void* const ctx, const uint8_t a, const uint8_t b) {
+  m8080_usart* const u = ctx;
+  uint8_t* p;
+  // like a transmitter that is not ready, a byte written anyway is lost
+  if(u->command & M8080_USART_TXEN && m8080_ring_writable(&u->tx, &p)) {
+    *p = b;
+    m8080_ring_commit(&u->tx, 1);
+    m8080_usart_update(u);
+  }
+}
+
+static void m8080_usart_control(m8080* const c, void* const ctx, const uint8_t a, const uint8_t b) {
+  m8080_usart* const u = ctx;
+  if(u->expect_mode) {
+    u->mode = b;
+    u->expect_mode = false;
+  } else if(b & M8080_USART_RESET) {
+    u->command = 0;
+    u->expect_mode = true;
+  } else {
+    u->command = b;
+  }
+  m8080_usart_update(u);
+}
+
+void m8080_usart_attach(m8080_usart* const u, m8080_port* const ports,
+    const uint8_t data, const uint8_t control) {
+  ports[data].in = m8080_usart_in;
+  ports[data].out = m8080_usart_out;
+  ports[data].ctx = u;
+  ports[control].in = NULL;
+  ports[control].out = m8080_usart_control;
+  ports[control].ctx = u;
+  u->status = &ports[control];
+  m8080_usart_update(u);
+}
+
+static bool m8080_usart_nonblocking(const int fd) {
+  const int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+bool m8080_usart_pty(m8080_usart* const u, char* const name, const size_t size) {
+  const int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if(fd < 0) return false;
+  const char* pts = NULL;
+  if(grantpt(fd) || unlockpt(fd) || !(pts = ptsname(fd)) || strlen(pts) >= size
+      || !m8080_usart_nonblocking(fd)) {
+    close(fd);
+    return false;
+  }
+  strcpy(name, pts);
+  // bytes go through as they are, the program does its own echo and line
+  // editing like on a real serial line
+  struct termios t;
+  if(tcgetattr(fd, &t) == 0) {
+    cfmakeraw(&t);
+    tcsetattr(fd, TCSANOW, &t);
+  }
+  u->fd = fd;
+  return true;
+}
+
+bool m8080_usart_listen(m8080_usart* const u, const char* const path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(addr.sun_path)) return false;
+  strcpy(addr.sun_path, path);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0) return false;
+  unlink(path);
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 1)
+      || !m8080_usart_nonblocking(fd)) {
+    close(fd);
+    return false;
+  }
+  u->listener = fd;
+  return true;
+}
+
+bool m8080_usart_pump(m8080_usart* const u) {
+  if(u->fd < 0 && u->listener >= 0) {
+    u->fd = accept(u->listener, NULL, NULL);
+    if(u->fd >= 0 && !m8080_usart_nonblocking(u->fd)) {
+      close(u->fd);
+      u->fd = -1;
+    }
+  }
+  bool open = u->fd >= 0 || u->listener >= 0;
+  for(int i = 0; u->fd >= 0 && i < 2; ++i) {
+    uint8_t* p;
+    const size_t size = m8080_ring_writable(&u->rx, &p);
+    if(!size) break;
+    const ssize_t n = read(u->fd, p, size);
+    if(n > 0) {
+      m8080_ring_commit(&u->rx, n);
+    } else if(n == 0 || (errno != EAGAIN && errno != EINTR)) {
+      // a pseudo-terminal reads EIO while nothing has it open, which is not
+      // the end of it, a socket connection is over and the next one is waited
+      // for
+      if(n < 0 && errno == EIO) break;
+      close(u->fd);
+      u->fd = -1;
+      open = u->listener >= 0;
+    } else {
+      break;
+    }
+  }
+  for(int i = 0; u->fd >= 0 && i < 2; ++i) {
+    const uint8_t* p;
+    const size_t size = m8080_ring_readable(&u->tx, &p);
+    if(!size) break;
+    const ssize_t n = write(u->fd, p, size);
+    if(n <= 0) break;
+    m8080_ring_consume(&u->tx, n);
+  }
+  m8080_usart_update(u);
+  return open;
+}
+
+#endif // M8080_USART_IMPLEMENTATION
+
+/*
+MIT License
+Copyright (c) 2019 Pedro Minicz
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/